@@ -1,188 +1,7371 @@
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
 #include <vector>
 #include <utility>
 #include <memory>
 #include <algorithm>
+#include <iostream>
+#include <unordered_map>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <array>
+#include <cstdio>
+#include <string>
+#include <system_error>
+#include <cerrno>
+#include <chrono>
+#include <mutex>
+#include <iterator>
+#if defined(__unix__) || defined(__APPLE__)
+#define LCTRIE_POSIX 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#if __has_include(<bit>)
+#include <bit>
+#endif
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define LCTRIE_COROUTINES 1
+#include <coroutine>
+#endif
+#if defined(LCTRIE_BENCHMARK)
+#include <benchmark/benchmark.h>
+#include <fstream>
+#include <random>
+#include <tuple>
+#endif
+#if defined(__SIZEOF_INT128__)
+#define LCTRIE_INT128 1
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#define LCTRIE_X86_SIMD 1
+#include <immintrin.h>
+#elif defined(__LZCNT__)
+#include <immintrin.h>
+#endif
 
-struct lctrie {
-    using key_type = uint32_t;
-    using value_type = uintptr_t;
-    using offset_type = uint8_t;
+/*
+ * The bit split of a trie node. The storage word is the narrowest unsigned
+ * type that holds all three fields.
+ */
+template <unsigned BranchBits, unsigned SkipBits, unsigned NextBits>
+struct node_layout {
+    static constexpr auto BRANCH_BITS = BranchBits;
+    static constexpr auto SKIP_BITS = SkipBits;
+    static constexpr auto NEXT_BITS = NextBits;
+    static constexpr auto BITS = BranchBits + SkipBits + NextBits;
+
+    static_assert(BranchBits >= 1U, "node_layout: branch needs at least one bit");
+    static_assert(SkipBits >= 1U, "node_layout: skip needs at least one bit");
+    static_assert(NextBits >= 1U, "node_layout: next needs at least one bit");
+    static_assert(BITS <= 64U, "node_layout: fields do not fit in 64 bits");
+
+    using storage_type = std::conditional_t<BITS <= 16U, uint16_t,
+                         std::conditional_t<BITS <= 32U, uint32_t, uint64_t>>;
+};
+
+/*
+ * Whether T can be a trie key: any unsigned integer type, and the
+ * compiler's 128-bit one where there is one, which strict language modes
+ * do not count as an integer type.
+ */
+template <typename T>
+inline constexpr bool is_lctrie_key_v = std::is_unsigned_v<T>;
+
+#if defined(LCTRIE_INT128)
+__extension__ typedef unsigned __int128 lctrie_uint128;
+
+template <>
+inline constexpr bool is_lctrie_key_v<lctrie_uint128> = true;
+#endif
+
+/*
+ * One contiguous block the arrays of a trie are carved from, front to
+ * back. Memory handed out is only returned with the whole arena. With
+ * huge pages on Linux, the block is mapped from the reserved 2 MB pages
+ * if possible and otherwise aligned to 2 MB and marked for transparent
+ * huge pages. Given a NUMA node, the block is mapped with a policy that
+ * prefers that node's memory, so the pages land there when first touched.
+ */
+struct trie_arena {
+    static constexpr size_t ALIGN = 64U;
+    static constexpr size_t HUGE_PAGE = size_t(2U) << 20U;
+
+    trie_arena(size_t bytes, bool huge_pages, int numa_node = -1);
+    ~trie_arena();
+
+    trie_arena(const trie_arena &) = delete;
+    trie_arena &operator=(const trie_arena &) = delete;
+
+    void *allocate(size_t bytes);
+    void prefer_node(int numa_node);
+
+    bool contains(const void *ptr) const
+    {
+        const auto p = static_cast<const char *>(ptr);
+        return p >= m_base && p < m_base + m_size;
+    }
+
+    // the bytes @n objects of T take in an arena
+    template <typename T>
+    static size_t footprint(const size_t n)
+    {
+        return (n * sizeof(T) + ALIGN - 1U) / ALIGN * ALIGN;
+    }
+
+    char *m_base = nullptr;
+    size_t m_size = 0U;
+    size_t m_used = 0U;
+
+    // what to unmap or free; m_base is m_block rounded up when aligning
+    void *m_block = nullptr;
+    size_t m_block_size = 0U;
+    bool m_mapped = false;
+};
+
+inline
+trie_arena::trie_arena(const size_t bytes, const bool huge_pages, const int numa_node)
+    : m_size(bytes)
+{
+#if defined(__linux__)
+    if ((huge_pages || numa_node >= 0) && bytes != 0U) {
+        const auto page = huge_pages ? HUGE_PAGE : size_t(::sysconf(_SC_PAGESIZE));
+        const auto size = (bytes + page - 1U) / page * page;
+        auto block = huge_pages ? ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)
+                                : MAP_FAILED;
+
+        if (block != MAP_FAILED) {
+            m_block = block;
+            m_block_size = size;
+            m_base = static_cast<char *>(block);
+        } else if (huge_pages) {
+            // one extra page to align to, for the kernel to back with THP
+            block = ::mmap(nullptr, size + HUGE_PAGE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (block == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+
+            m_block = block;
+            m_block_size = size + HUGE_PAGE;
+            m_base = reinterpret_cast<char *>(
+                (reinterpret_cast<uintptr_t>(block) + HUGE_PAGE - 1U) / HUGE_PAGE * HUGE_PAGE);
+            ::madvise(m_base, size, MADV_HUGEPAGE);
+        } else {
+            block = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (block == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+
+            m_block = block;
+            m_block_size = size;
+            m_base = static_cast<char *>(block);
+        }
+
+        if (numa_node >= 0) {
+            prefer_node(numa_node);
+        }
+
+        m_mapped = true;
+        return;
+    }
+#else
+    (void)huge_pages;
+    (void)numa_node;
+#endif
+
+    m_block = ::operator new(bytes, std::align_val_t(ALIGN));
+    m_base = static_cast<char *>(m_block);
+}
+
+/*
+ * Sets a policy on the mapped block that allocates its pages from
+ * @numa_node while that has free memory, and from other nodes after. The
+ * pages are untouched yet, so nothing moves. A kernel without NUMA support
+ * or a node that does not exist leaves the default policy in place.
+ */
+inline void
+trie_arena::prefer_node(const int numa_node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    constexpr int MPOL_PREFERRED_MODE = 1;
+    constexpr size_t WORD_BITS = std::numeric_limits<unsigned long>::digits;
+
+    std::vector<unsigned long> mask(size_t(numa_node) / WORD_BITS + 1U, 0UL);
+
+    mask[size_t(numa_node) / WORD_BITS] |= 1UL << (size_t(numa_node) % WORD_BITS);
+    // the kernel reads one bit less than it is told
+    ::syscall(SYS_mbind, m_base, m_block_size - size_t(m_base - static_cast<char *>(m_block)),
+              MPOL_PREFERRED_MODE, mask.data(), mask.size() * WORD_BITS + 1U, 0U);
+#else
+    (void)numa_node;
+#endif
+}
+
+inline
+trie_arena::~trie_arena()
+{
+#if defined(__linux__)
+    if (m_mapped) {
+        ::munmap(m_block, m_block_size);
+        return;
+    }
+#endif
+
+    ::operator delete(m_block, std::align_val_t(ALIGN));
+}
+
+/*
+ * Returns @bytes from the arena on a cache line, or nullptr when full
+ */
+inline void *
+trie_arena::allocate(const size_t bytes)
+{
+    const auto size = (bytes + ALIGN - 1U) / ALIGN * ALIGN;
+
+    if (size > m_size - m_used) {
+        return nullptr;
+    }
+
+    const auto ptr = m_base + m_used;
+    m_used += size;
+    return ptr;
+}
+
+/*
+ * The NUMA nodes that are online, in ascending order; a machine or kernel
+ * that does not say has the one node 0
+ */
+inline std::vector<int>
+numa_nodes()
+{
+    std::vector<int> nodes;
+
+#if defined(__linux__)
+    if (auto file = std::fopen("/sys/devices/system/node/online", "r")) {
+        int first = 0;
+        int last = 0;
+
+        // a list of ranges like 0-1,4
+        while (std::fscanf(file, "%d", &first) == 1) {
+            last = first;
+
+            if (std::fscanf(file, "-%d", &last) != 1) {
+                last = first;
+            }
+
+            for (auto node = first; node <= last; ++node) {
+                nodes.push_back(node);
+            }
+
+            if (std::fgetc(file) != ',') {
+                break;
+            }
+        }
+
+        std::fclose(file);
+    }
+#endif
+
+    if (nodes.empty()) {
+        nodes.push_back(0);
+    }
+
+    return nodes;
+}
+
+/*
+ * The NUMA node of the CPU the calling thread is running on, 0 where that
+ * is unknown. The thread may move unless it is pinned.
+ */
+inline int
+current_numa_node()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu = 0U;
+    unsigned node = 0U;
+
+    if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+        return int(node);
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * Allocates every trie array on a cache line boundary, so blocks of nodes
+ * aligned within the array are aligned in memory as well. An allocator
+ * bound to an arena carves from it while it has room and falls back to
+ * the heap; copies of a container are always made on the heap.
+ */
+template <typename T>
+struct cache_allocator {
+    using value_type = T;
+
+    static constexpr size_t ALIGN = trie_arena::ALIGN;
+
+    cache_allocator() = default;
+
+    explicit cache_allocator(trie_arena *arena) : m_arena(arena) {}
+
+    template <typename U>
+    cache_allocator(const cache_allocator<U> &other) : m_arena(other.m_arena) {}
+
+    T *allocate(const size_t n)
+    {
+        if (m_arena != nullptr) {
+            if (const auto ptr = m_arena->allocate(n * sizeof(T))) {
+                return static_cast<T *>(ptr);
+            }
+        }
+
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(ALIGN)));
+    }
+
+    void deallocate(T *ptr, size_t)
+    {
+        if (m_arena != nullptr && m_arena->contains(ptr)) {
+            return;
+        }
+
+        ::operator delete(ptr, std::align_val_t(ALIGN));
+    }
+
+    cache_allocator select_on_container_copy_construction() const { return {}; }
+
+    template <typename U>
+    bool operator==(const cache_allocator<U> &other) const { return m_arena == other.m_arena; }
+
+    template <typename U>
+    bool operator!=(const cache_allocator<U> &other) const { return m_arena != other.m_arena; }
+
+    trie_arena *m_arena = nullptr;
+};
+
+template <typename T>
+using cache_vector = std::vector<T, cache_allocator<T>>;
+
+/*
+ * Runs @work(0) .. @work(threads - 1), @work(0) on the calling thread. If
+ * a thread cannot be started, the calling thread runs its index as well,
+ * so every index runs exactly once; @work must not throw.
+ */
+template <typename F>
+void run_threads(const unsigned threads, const F &work)
+{
+    std::vector<std::thread> pool;
+    auto started = 1U;
+
+    try {
+        for (; started < threads; ++started) {
+            pool.emplace_back(work, started);
+        }
+    } catch (const std::system_error &) {
+        // run the rest here
+    }
+
+    work(0U);
+
+    for (auto i = started; i < threads; ++i) {
+        work(i);
+    }
+
+    for (auto &thread : pool) {
+        thread.join();
+    }
+}
+
+// leaves as an array of naturally aligned structs
+struct leaf_aos {
+    static constexpr uint32_t ID = 0U;
+};
+
+// leaves as an array of structs without padding
+struct leaf_packed {
+    static constexpr uint32_t ID = 1U;
+};
+
+// leaves as one array per field
+struct leaf_soa {
+    static constexpr uint32_t ID = 2U;
+};
+
+/*
+ * A leaf of the base vector: its key and prefix length, the offset of its
+ * value in m_vals and the index of its longest enclosing prefix
+ */
+template <typename Key, typename OffsetT>
+struct leaf_entry {
+    Key key;
+    uint8_t len;
+    OffsetT offset;
+    uint32_t pre;
+};
+
+#pragma pack(push, 1)
+template <typename Key, typename OffsetT>
+struct packed_leaf_entry {
+    Key key;
+    uint8_t len;
+    OffsetT offset;
+    uint32_t pre;
+};
+#pragma pack(pop)
+
+/*
+ * One field of every leaf, as seen by the vector kernels: the field of
+ * leaf i is the low bytes of the 32-bit word at base + i * stride
+ */
+struct leaf_field {
+    const char *base;
+    size_t stride;
+};
+
+// one array of a leaf layout as save() writes it
+struct leaf_section {
+    const void *data;
+    size_t bytes;
+};
+
+/*
+ * The base vector for the leaf_aos and leaf_packed layouts
+ */
+template <typename Key, typename OffsetT, typename Layout>
+struct leaf_array {
+    using entry_type = std::conditional_t<std::is_same_v<Layout, leaf_packed>,
+        packed_leaf_entry<Key, OffsetT>, leaf_entry<Key, OffsetT>>;
+
+    // every field can be read as a 32-bit word without leaving its entry
+    static constexpr bool WORD_FIELDS =
+        offsetof(entry_type, len) + 4U <= sizeof(entry_type) &&
+        offsetof(entry_type, offset) + 4U <= sizeof(entry_type);
+
+    explicit leaf_array(trie_arena *arena = nullptr) : m_entries(cache_allocator<entry_type>(arena)) {}
+
+    size_t size() const { return m_entries.size(); }
+    bool empty() const { return m_entries.empty(); }
+    size_t capacity() const { return m_entries.capacity(); }
+    void reserve(const size_t n) { m_entries.reserve(n); }
+
+    // the arena bytes room for @n leaves takes
+    static size_t footprint(const size_t n) { return trie_arena::footprint<entry_type>(n); }
+
+    void assign(const leaf_array &other, const size_t n)
+    {
+        m_entries.reserve(n);
+        m_entries.assign(other.m_entries.begin(), other.m_entries.end());
+    }
+
+    static constexpr size_t SECTIONS = 1U;
+
+    std::array<leaf_section, SECTIONS> sections() const
+    {
+        return { { { m_entries.data(), m_entries.size() * sizeof(entry_type) } } };
+    }
+
+    // the bytes of each section for @n leaves
+    static std::array<size_t, SECTIONS> section_bytes(const size_t n)
+    {
+        return { { n * sizeof(entry_type) } };
+    }
+
+    // the leaves of a mapped image; reads like the array itself
+    struct view_type {
+        explicit view_type(const std::array<const void *, SECTIONS> &sections)
+            : m_entries(static_cast<const entry_type *>(sections[0]))
+        {
+        }
+
+        Key key(const size_t i) const { return m_entries[i].key; }
+        Key diff(const size_t i, const Key k) const { return m_entries[i].key ^ k; }
+        uint8_t len(const size_t i) const { return m_entries[i].len; }
+        OffsetT offset(const size_t i) const { return m_entries[i].offset; }
+        uint32_t pre(const size_t i) const { return m_entries[i].pre; }
+        const void *address(const size_t i) const { return &m_entries[i]; }
+
+        leaf_field key_field() const { return field(offsetof(entry_type, key)); }
+        leaf_field len_field() const { return field(offsetof(entry_type, len)); }
+        leaf_field offset_field() const { return field(offsetof(entry_type, offset)); }
+
+        leaf_field field(const size_t offset) const
+        {
+            return { reinterpret_cast<const char *>(m_entries) + offset, sizeof(entry_type) };
+        }
+
+        const entry_type *m_entries;
+    };
+
+    void push_back(const leaf_entry<Key, OffsetT> &leaf)
+    {
+        m_entries.push_back({ leaf.key, leaf.len, leaf.offset, leaf.pre });
+    }
+
+    void set_offset(const size_t i, const OffsetT offset) { m_entries[i].offset = offset; }
+
+    Key key(const size_t i) const { return m_entries[i].key; }
+    Key diff(const size_t i, const Key k) const { return m_entries[i].key ^ k; }
+    uint8_t len(const size_t i) const { return m_entries[i].len; }
+    OffsetT offset(const size_t i) const { return m_entries[i].offset; }
+    uint32_t pre(const size_t i) const { return m_entries[i].pre; }
+    const void *address(const size_t i) const { return &m_entries[i]; }
+    size_t bytes() const { return m_entries.size() * sizeof(entry_type); }
+
+    leaf_field key_field() const { return field(offsetof(entry_type, key)); }
+    leaf_field len_field() const { return field(offsetof(entry_type, len)); }
+    leaf_field offset_field() const { return field(offsetof(entry_type, offset)); }
+
+    leaf_field field(const size_t offset) const
+    {
+        return { reinterpret_cast<const char *>(m_entries.data()) + offset, sizeof(entry_type) };
+    }
+
+    cache_vector<entry_type> m_entries;
+};
+
+/*
+ * The base vector for the leaf_soa layout. A lookup that only compares the
+ * leaf reads the key and len arrays; pre is only read on a mismatch. The
+ * narrow arrays keep PAD spare zero entries at their end, so the vector
+ * kernels can read any field as a 32-bit word.
+ */
+template <typename Key, typename OffsetT>
+struct leaf_array<Key, OffsetT, leaf_soa> {
+    static constexpr size_t PAD = 3U;
+    static constexpr bool WORD_FIELDS = true;
+
+    explicit leaf_array(trie_arena *arena = nullptr)
+        : m_keys(cache_allocator<Key>(arena)),
+          m_lens(PAD, 0U, cache_allocator<uint8_t>(arena)),
+          m_offsets(PAD, 0U, cache_allocator<OffsetT>(arena)),
+          m_pres(cache_allocator<uint32_t>(arena))
+    {
+    }
+
+    size_t size() const { return m_keys.size(); }
+    bool empty() const { return m_keys.empty(); }
+
+    // includes the PAD entries the constructor allocates before reserve()
+    static size_t footprint(const size_t n)
+    {
+        return trie_arena::footprint<Key>(n) + trie_arena::footprint<uint8_t>(n + PAD) +
+            trie_arena::footprint<OffsetT>(n + PAD) + trie_arena::footprint<uint32_t>(n) +
+            trie_arena::footprint<uint8_t>(PAD) + trie_arena::footprint<OffsetT>(PAD);
+    }
+
+    void assign(const leaf_array &other, const size_t n)
+    {
+        reserve(n);
+        m_keys.assign(other.m_keys.begin(), other.m_keys.end());
+        m_lens.assign(other.m_lens.begin(), other.m_lens.end());
+        m_offsets.assign(other.m_offsets.begin(), other.m_offsets.end());
+        m_pres.assign(other.m_pres.begin(), other.m_pres.end());
+    }
+
+    static constexpr size_t SECTIONS = 4U;
+
+    // the narrow arrays are written with their PAD entries
+    std::array<leaf_section, SECTIONS> sections() const
+    {
+        const auto bytes = section_bytes(size());
+
+        return { { { m_keys.data(), bytes[0] }, { m_lens.data(), bytes[1] },
+                   { m_offsets.data(), bytes[2] }, { m_pres.data(), bytes[3] } } };
+    }
+
+    static std::array<size_t, SECTIONS> section_bytes(const size_t n)
+    {
+        return { { n * sizeof(Key), (n + PAD) * sizeof(uint8_t),
+                   (n + PAD) * sizeof(OffsetT), n * sizeof(uint32_t) } };
+    }
+
+    struct view_type {
+        explicit view_type(const std::array<const void *, SECTIONS> &sections)
+            : m_keys(static_cast<const Key *>(sections[0])),
+              m_lens(static_cast<const uint8_t *>(sections[1])),
+              m_offsets(static_cast<const OffsetT *>(sections[2])),
+              m_pres(static_cast<const uint32_t *>(sections[3]))
+        {
+        }
+
+        Key key(const size_t i) const { return m_keys[i]; }
+        Key diff(const size_t i, const Key k) const { return m_keys[i] ^ k; }
+        uint8_t len(const size_t i) const { return m_lens[i]; }
+        OffsetT offset(const size_t i) const { return m_offsets[i]; }
+        uint32_t pre(const size_t i) const { return m_pres[i]; }
+        const void *address(const size_t i) const { return &m_keys[i]; }
+
+        // the image keeps the PAD entries, as the vector kernels need
+        leaf_field key_field() const { return { reinterpret_cast<const char *>(m_keys), sizeof(Key) }; }
+        leaf_field len_field() const { return { reinterpret_cast<const char *>(m_lens), sizeof(uint8_t) }; }
+        leaf_field offset_field() const { return { reinterpret_cast<const char *>(m_offsets), sizeof(OffsetT) }; }
+
+        const Key *m_keys;
+        const uint8_t *m_lens;
+        const OffsetT *m_offsets;
+        const uint32_t *m_pres;
+    };
+
+    size_t capacity() const
+    {
+        return std::min({ m_keys.capacity(), m_lens.capacity() - PAD,
+                          m_offsets.capacity() - PAD, m_pres.capacity() });
+    }
+
+    void reserve(const size_t n)
+    {
+        m_keys.reserve(n);
+        m_lens.reserve(n + PAD);
+        m_offsets.reserve(n + PAD);
+        m_pres.reserve(n);
+    }
+
+    void push_back(const leaf_entry<Key, OffsetT> &leaf)
+    {
+        const auto i = m_keys.size();
+
+        m_keys.push_back(leaf.key);
+        m_lens.push_back(0U);
+        m_lens[i] = leaf.len;
+        m_offsets.push_back(0U);
+        m_offsets[i] = leaf.offset;
+        m_pres.push_back(leaf.pre);
+    }
+
+    void set_offset(const size_t i, const OffsetT offset) { m_offsets[i] = offset; }
+
+    Key key(const size_t i) const { return m_keys[i]; }
+    Key diff(const size_t i, const Key k) const { return m_keys[i] ^ k; }
+    uint8_t len(const size_t i) const { return m_lens[i]; }
+    OffsetT offset(const size_t i) const { return m_offsets[i]; }
+    uint32_t pre(const size_t i) const { return m_pres[i]; }
+    const void *address(const size_t i) const { return &m_keys[i]; }
+
+    size_t bytes() const
+    {
+        return m_keys.size() * (sizeof(Key) + sizeof(uint8_t) + sizeof(OffsetT) + sizeof(uint32_t));
+    }
+
+    leaf_field key_field() const
+    {
+        return { reinterpret_cast<const char *>(m_keys.data()), sizeof(Key) };
+    }
+
+    leaf_field len_field() const
+    {
+        return { reinterpret_cast<const char *>(m_lens.data()), sizeof(uint8_t) };
+    }
+
+    leaf_field offset_field() const
+    {
+        return { reinterpret_cast<const char *>(m_offsets.data()), sizeof(OffsetT) };
+    }
+
+    cache_vector<Key> m_keys;
+    cache_vector<uint8_t> m_lens;
+    cache_vector<OffsetT> m_offsets;
+    cache_vector<uint32_t> m_pres;
+};
+
+/*
+ * The start of a trie image as save() writes it. Each array follows as a
+ * section at an offset from the start of the image, on a cache line and
+ * with no pointers in it, so an image mapped at any address serves lookups
+ * in place. The fields after endian name the trie type the image was
+ * written for; lctrie_view refuses any other.
+ */
+struct lctrie_image_header {
+    static constexpr uint32_t VERSION = 1U;
+    static constexpr uint32_t ENDIAN_MARK = 0x01020304U;
+    static constexpr size_t ALIGN = 64U;
+    static constexpr size_t MAX_SECTIONS = 8U;
+
+    // nodes, prefixes and values come first, then the leaf layout's arrays
+    enum : size_t {
+        NODES,
+        PREFIXES,
+        VALUES,
+        LEAVES
+    };
+
+    struct section_type {
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    static constexpr char MAGIC[8] = { 'L', 'C', 'T', 'R', 'I', 'E', '\r', '\n' };
+
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t key_bytes;
+    uint32_t offset_bytes;
+    uint32_t value_bytes;
+    uint32_t node_bytes;
+    uint32_t branch_bits;
+    uint32_t skip_bits;
+    uint32_t next_bits;
+    uint32_t leaf_layout;
+    uint64_t nodes;
+    uint64_t leaves;
+    uint64_t prefixes;
+    uint64_t values;
+    uint64_t size;
+    uint64_t sections;
+    section_type section[MAX_SECTIONS];
+};
+
+/*
+ * The default instrumentation policy of a trie: lookups call these hooks
+ * on their walk, and they compile to nothing. lookup_counters is the one
+ * that counts.
+ */
+struct no_instrumentation {
+    static constexpr bool ENABLED = false;
+
+    // @lookups walks that read @levels nodes between them
+    static constexpr void walk(size_t, size_t) {}
+
+    // the leaf's own compare failed: the bits the walk skipped differ
+    static constexpr void skip_failure() {}
+
+    // an entry of the prefix vector was compared
+    static constexpr void fallback() {}
+
+    // no route matched
+    static constexpr void miss() {}
+};
+
+template <typename Key, typename Value, typename OffsetT, typename NodeLayout,
+          typename LeafLayout = leaf_aos, typename Instrument = no_instrumentation>
+struct basic_lctrie {
+    using key_type = Key;
+    using value_type = Value;
+    using offset_type = OffsetT;
+    using pre_type = uint32_t;
+    using layout_type = NodeLayout;
+    using leaf_layout_type = LeafLayout;
+    using instrument_type = Instrument;
     using input_type = std::vector<std::pair<key_type, value_type>>;
 
-    using node_type = struct node {
-        uint32_t branch : 5,
-        uint32_t skip : 7,
-        uint32_t next : 20
+    // a CIDR route; the bits of prefix below len are expected to be clear
+    struct route_type {
+        key_type prefix;
+        uint8_t len;
+        value_type value;
+    };
+
+    using route_input_type = std::vector<route_type>;
+
+    // routes by prefix alone, as a withdraw names them
+    using prefix_input_type = std::vector<std::pair<key_type, uint8_t>>;
+
+    // a route whose value has been interned into m_vals
+    struct mapped_route {
+        key_type prefix;
+        uint8_t len;
+        offset_type offset;
+    };
+
+    using mapped_input_type = std::vector<mapped_route>;
+    using value_input_type = std::vector<value_type>;
+    using value_map_type = std::unordered_map<value_type, offset_type>;
+
+    using node_storage = typename layout_type::storage_type;
+
+    // the order of the child blocks in m_nodes; see relayout()
+    enum class node_order {
+        depth_first,
+        breadth_first,
+        van_emde_boas
+    };
+
+    // which of several routes with the same prefix and length ingest() keeps
+    enum class duplicate_policy {
+        last_wins,
+        first_wins
+    };
+
+    struct build_options {
+        // when non-zero, the root branches on exactly this many bits, even
+        // if that leaves some of its children empty
+        unsigned root_branch = 0U;
+
+        // the fraction of its 2^branch children a node must fill; lower
+        // values give shallower tries with more empty slots
+        double fill_factor = 1.0;
+
+        // start every block of children on a cache line, or within one
+        // when the block is smaller, at the cost of some padding nodes
+        bool align_children = false;
+
+        // the fraction of m_nodes or m_data that insert() and erase() may
+        // leave unreachable before they recompact the whole trie
+        double max_garbage = 0.5;
+
+        // threads a full build may use, 0 for one per hardware thread;
+        // small tables are always built on the calling thread
+        unsigned threads = 1U;
+
+        duplicate_policy duplicates = duplicate_policy::last_wins;
+
+        // how a full build lays out m_nodes; make_node() builds depth first
+        node_order order = node_order::depth_first;
+
+        // after a full build, move every array into one contiguous arena
+        bool arena = false;
+
+        // back the arena with 2 MB pages: reserved huge pages if there
+        // are any, transparent ones otherwise; implies arena
+        bool huge_pages = false;
+
+        // back the arena with memory of this NUMA node, -1 for wherever
+        // the threads touching it run; Linux only, implies arena
+        int numa_node = -1;
     };
 
-    // this should be packed for space savings
-    using data_type = struct data {
-        key_type key,
-        offset_type offset
-    };
+    // what try_insert() and try_erase() did
+    enum class update_status {
+        applied,
+        not_found,
+        no_room
+    };
+
+    // what apply_batch() did
+    struct batch_result {
+        // withdraws that found their route
+        size_t withdrawn;
+        // stored routes given a new value
+        size_t updated;
+        // subtries rebuilt in place, 0 when the whole trie was rebuilt
+        size_t subtries;
+        // routes in the rebuilt part
+        size_t routes;
+    };
+
+    struct memory_usage {
+        size_t nodes;
+        size_t leaves;
+        size_t prefixes;
+        size_t values;
+        size_t total;
+        double bytes_per_route;
+    };
+
+    // the shape of a built trie, as stats() finds it
+    struct trie_stats {
+        // nodes in m_nodes, those a lookup can reach, and the reachable
+        // ones that branch
+        size_t nodes;
+        size_t reachable_nodes;
+        size_t internal_nodes;
+
+        // reachable leaf slots that hold no key of their own, left by a
+        // fill factor below 1 or a forced root branch
+        size_t empty_slots;
+
+        // live leaves, and the prefixes their chains lead to
+        size_t leaves;
+        size_t prefixes;
+
+        // depth[d] leaves are reached in d node reads from the root, and
+        // the average and max are over leaves, one per route
+        std::vector<size_t> depth;
+        double average_depth;
+        size_t max_depth;
+
+        // branch[b] and skip[s] internal nodes branch on b bits and skip s
+        std::vector<size_t> branch;
+        std::vector<size_t> skip;
+
+        memory_usage memory;
+    };
+
+    struct node_type {
+        node_storage branch : layout_type::BRANCH_BITS;
+        node_storage skip : layout_type::SKIP_BITS;
+        node_storage next : layout_type::NEXT_BITS;
+    };
+
+    // a leaf as it is handed to the base vector; how it is stored is up
+    // to the leaf layout
+    using data_type = leaf_entry<key_type, offset_type>;
+    using data_array = leaf_array<key_type, offset_type, leaf_layout_type>;
+
+    // an entry of the prefix vector; its bits are those of any leaf
+    // (or prefix) that points at it, so the key itself is not stored
+    struct prefix_type {
+        uint8_t len;
+        offset_type offset;
+        pre_type pre;
+    };
+
+    static constexpr auto KEY_BYTES = unsigned(sizeof(key_type));
+    static constexpr auto KEY_BITS = 8U * KEY_BYTES;
+    static constexpr auto MAX_BRANCH =
+        std::min((1U << layout_type::BRANCH_BITS) - 1U, 31U);
+    static constexpr auto MAX_NEXT =
+        (uint64_t(1U) << layout_type::NEXT_BITS) - 1U;
+    static constexpr auto MAX_OFFSET =
+        uint64_t(std::numeric_limits<offset_type>::max());
+
+    static_assert(is_lctrie_key_v<key_type>, "lctrie: key must be unsigned");
+    static_assert(std::is_unsigned_v<offset_type>, "lctrie: offset must be unsigned");
+    static_assert(KEY_BITS <= 0xFFU, "lctrie: prefix lengths must fit in uint8_t");
+    static_assert((uint64_t(1U) << layout_type::SKIP_BITS) - 1U >= KEY_BITS - 1U,
+                  "lctrie: skip field too narrow for the key width");
+    static_assert(sizeof(node_type) == sizeof(node_storage),
+                  "lctrie: node fields must pack into one storage word");
+
+    // returned by lookup() when the key is not in the trie
+    static constexpr value_type NO_VALUE = value_type(0U);
+
+    // terminates a chain of prefix vector entries
+    static constexpr pre_type NO_PREFIX = ~pre_type(0);
+
+    // number of keys lookup_batch() walks in lockstep
+    static constexpr size_t BATCH_SIZE = 16U;
+
+    // the fewest keys a parallel build hands to a worker at once
+    static constexpr size_t BUILD_GRAIN = 4096U;
+
+    // the fewest routes ingest() sorts on more than one thread
+    static constexpr size_t SORT_GRAIN = 65536U;
+
+    // the vector kernels gather whole node words and 32-bit words of the
+    // leaves, so they only apply to 32-bit keys in 32-bit nodes
+    static constexpr bool SIMD_LAYOUT =
+        sizeof(key_type) == 4U && sizeof(node_type) == 4U && data_array::WORD_FIELDS;
+
+    /*
+     * Visits the stored routes in (prefix, len) order, or those under a
+     * prefix, with no allocation: a depth-first walk of the nodes with a
+     * fixed stack finds each live leaf, and the prefixes of its chain that
+     * an earlier leaf has not emitted come out first, shortest first. A
+     * leaf is live where the walk for its own key ends, which skips the
+     * empty slots that share it and the garbage updates left behind. The
+     * trie must not change while an iterator is in use.
+     */
+    struct route_iterator {
+        using iterator_category = std::input_iterator_tag;
+        using value_type = route_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const route_type *;
+        using reference = const route_type &;
+
+        // a node being walked: its children, the next to visit, and the
+        // key bits fixed and branched on above them
+        struct frame {
+            size_t next;
+            size_t count;
+            size_t index;
+            key_type fixed;
+            key_type mask;
+            unsigned shift;
+        };
+
+        route_iterator() = default;
+        route_iterator(const basic_lctrie *trie, key_type prefix, uint8_t len);
+
+        reference operator*() const { return m_route; }
+        pointer operator->() const { return &m_route; }
+        route_iterator &operator++();
+        bool operator==(const route_iterator &other) const;
+        bool operator!=(const route_iterator &other) const { return !(*this == other); }
+
+        bool covers(const mapped_route &route) const;
+        bool next_leaf(size_t &leaf);
+
+        // nullptr once past the last route
+        const basic_lctrie *m_trie = nullptr;
+        key_type m_prefix = 0U;
+        uint8_t m_len = 0U;
+        bool m_root_leaf = false;
+        size_t m_depth = 0U;
+        std::array<frame, KEY_BITS> m_frames;
+
+        // the prefixes emitted that cover the current leaf, longest last
+        size_t m_opened = 0U;
+        std::array<mapped_route, KEY_BITS + 1U> m_open;
+
+        // the routes of the current leaf not yet visited
+        size_t m_pending = 0U;
+        size_t m_emitted = 0U;
+        std::array<mapped_route, KEY_BITS + 2U> m_routes;
+
+        route_type m_route = {};
+    };
+
+    struct route_range {
+        route_iterator begin() const { return m_begin; }
+        route_iterator end() const { return route_iterator(); }
+
+        route_iterator m_begin;
+    };
+
+    void set_options(const build_options &options);
+    void ingest(route_input_type &routes) const;
+    void radix_sort(route_input_type &routes) const;
+    unsigned thread_count() const;
+    void init(const input_type &input);
+    void init(const route_input_type &routes);
+    void init(const route_input_type &routes, const value_input_type &values);
+    void init_shared(const route_input_type &routes, const value_map_type &offsets);
+    void init_trie();
+    void init_map(const route_input_type &routes, const value_input_type *values,
+                  const value_map_type *offsets = nullptr);
+    void add_routes(const mapped_input_type &routes, pre_type outer);
+
+    // the prefixes covering the route add_route() is adding, longest last
+    using open_prefixes = std::vector<std::pair<mapped_route, pre_type>>;
+
+    void add_route(const mapped_route &route, const mapped_route *next, open_prefixes &open,
+                   pre_type outer);
+    void check_routes() const;
+    offset_type intern(value_type val, value_map_type &map);
+    void insert(key_type prefix, uint8_t len, value_type value);
+    bool erase(key_type prefix, uint8_t len);
+    update_status try_insert(key_type prefix, uint8_t len, value_type value);
+    update_status try_erase(key_type prefix, uint8_t len);
+    batch_result apply_batch(const route_input_type &adds, const prefix_input_type &withdraws);
+    update_status try_apply_batch(const route_input_type &adds, const prefix_input_type &withdraws,
+                                  batch_result &result);
+    void recompact();
+    void relayout(node_order order);
+    void relayout(const key_type *keys, size_t n);
+    void relayout(const std::vector<uint64_t> &leaf_hits);
+    std::unique_ptr<basic_lctrie> clone() const;
+    std::unique_ptr<basic_lctrie> replicate(int numa_node) const;
+    void reserve_headroom(double fraction);
+    // the arrays a lookup reads, owned by a trie or mapped by lctrie_view
+    template <typename Leaves>
+    struct table_view {
+        const node_type *nodes;
+        const Leaves *leaves;
+        const prefix_type *prefixes;
+        const value_type *vals;
+    };
+
+    table_view<data_array> tables() const;
+    static constexpr node_type load_node(const node_type &slot);
+    template <typename Leaves>
+    static constexpr value_type find(const table_view<Leaves> &t, key_type key);
+    template <typename Leaves>
+    static constexpr value_type find(const table_view<Leaves> &t, node_type root, key_type key);
+    template <typename Leaves>
+    static constexpr value_type find_leaf(const table_view<Leaves> &t, size_t leaf, key_type key);
+    template <typename Leaves>
+    static void find_batch(const table_view<Leaves> &t, const key_type *keys, value_type *out, size_t n);
+    template <typename Leaves>
+    static void find_batch_widest(const table_view<Leaves> &t, size_t leaf_bytes, const key_type *keys,
+                                  value_type *out, size_t n);
+#if defined(LCTRIE_X86_SIMD)
+    template <typename Leaves>
+    __attribute__((target("avx2")))
+    static void find_batch_avx2(const table_view<Leaves> &t, const key_type *keys, value_type *out, size_t n);
+    template <typename Leaves>
+    __attribute__((target("avx512f")))
+    static void find_batch_avx512(const table_view<Leaves> &t, const key_type *keys, value_type *out, size_t n);
+#endif
+
+    value_type lookup(key_type key) const;
+    value_type lookup_leaf(size_t leaf, key_type key) const;
+    void lookup_batch(const key_type *keys, value_type *out, size_t n) const;
+    void lookup_batch_scalar(const key_type *keys, value_type *out, size_t n) const;
+#if defined(LCTRIE_X86_SIMD)
+    __attribute__((target("avx2")))
+    void lookup_batch_avx2(const key_type *keys, value_type *out, size_t n) const;
+    __attribute__((target("avx512f")))
+    void lookup_batch_avx512(const key_type *keys, value_type *out, size_t n) const;
+#endif
+    uint64_t generation() const;
+    size_t value_count() const;
+    memory_usage memory() const;
+    trie_stats stats() const;
+    route_range routes() const;
+    route_range routes(key_type prefix, uint8_t len) const;
+    template <typename Fn>
+    void for_each_covered(key_type prefix, uint8_t len, Fn &&fn) const;
+    void save(const std::string &path) const;
+    static constexpr uint32_t extract(uint8_t pos, uint8_t branch, key_type k);
+    static constexpr key_type prefix_mask(uint8_t len);
+    static constexpr bool is_prefix(const mapped_route &a, const mapped_route &b);
+    static constexpr bool route_less(const mapped_route &a, const mapped_route &b);
+    static constexpr bool route_equal(const mapped_route &a, const mapped_route &b);
+
+    size_t compute_skip(size_t first, size_t nkeys, size_t pre) const;
+    size_t find_fork(size_t first, size_t last, size_t suffix_len) const;
+    size_t compute_branch(size_t first, size_t nkeys, size_t pre) const;
+    size_t align_block(size_t next, size_t branch) const;
+    size_t nearest_leaf(size_t first, size_t last, size_t pos, key_type slot, size_t len) const;
+    size_t max_nodes(size_t nkeys) const;
+
+    // a subtrie the top of a parallel build left to the workers: the
+    // @nkeys keys from @first, @pre bits deep, hanging off m_nodes[pos]
+    struct build_task {
+        size_t first;
+        size_t nkeys;
+        size_t pre;
+        size_t pos;
+    };
+
+    // the subtries make_node() defers: those of at most grain keys, and
+    // at least grain / 64, below which a task is not worth its padding
+    struct build_split {
+        std::vector<build_task> tasks;
+        size_t grain;
+    };
+
+    void make_node(cache_vector<node_type> &nodes, size_t first, size_t nkeys, size_t pre,
+                   size_t pos, size_t branch, build_split *split);
+    void build_parallel(const std::vector<build_task> &tasks, unsigned threads);
+    static void publish_node(cache_vector<node_type> &nodes, size_t pos, node_type node);
+
+    // what collect() found under a slot
+    struct collect_state {
+        mapped_input_type routes;
+        pre_type outer;
+        bool outer_own;
+        size_t nodes;
+        size_t leaves;
+        // the prefixes emitted for the last leaf of the slot, longest first
+        std::vector<pre_type> chain;
+    };
+
+    // a slot the walk for a key passes: its position, the bits consumed
+    // above it, and the bits its parent had consumed
+    struct update_slot {
+        size_t pos;
+        size_t depth;
+        size_t shared;
+    };
+
+    // a change apply_batch() makes, and the slot of the walk for it, at
+    // @index below the root, that its rebuild starts from
+    struct batch_change {
+        mapped_route route;
+        bool erase;
+        size_t index;
+        update_slot slot;
+    };
+
+    // the subtrie apply_batch() rebuilds for the changes [first, last)
+    struct batch_group {
+        update_slot slot;
+        size_t index;
+        size_t first;
+        size_t last;
+        size_t withdrawn;
+        bool collected;
+        collect_state state;
+    };
+
+    // where locate() found a route: a leaf, or else a prefix entry
+    struct route_location {
+        bool found;
+        bool leaf;
+        size_t index;
+    };
+
+    route_location locate(const mapped_route &route) const;
+    size_t update_path(const mapped_route &route, update_slot *path) const;
+    static size_t merge_changes(mapped_input_type &routes, const batch_change *first,
+                                const batch_change *last);
+    void rebuild_all(const std::vector<batch_change> &changes, batch_result &result);
+    update_status update_batch(const route_input_type &adds, const prefix_input_type &withdraws,
+                               bool in_place, batch_result &result);
+    update_status update(const mapped_route &route, bool erase, bool in_place);
+    bool has_room(const collect_state &state) const;
+    void rebuild(const mapped_input_type &routes);
+    void reserve_routes(const mapped_input_type &routes);
+    void move_to_arena(double headroom);
+    void copy_to_arena(const basic_lctrie &from, size_t nodes, size_t leaves, size_t prefixes,
+                       size_t values);
+
+    // the 2^branch children of an internal node, and the range of blocks
+    // of its children's children
+    struct node_block {
+        size_t next;
+        size_t branch;
+        size_t children;
+        size_t end;
+    };
+
+    std::vector<node_block> node_blocks(std::vector<size_t> &at) const;
+    static void veb_order(const std::vector<node_block> &blocks, size_t b, size_t height,
+                          std::vector<size_t> &order);
+    void place_blocks(const std::vector<node_block> &blocks, const std::vector<size_t> &at,
+                      const std::vector<size_t> &order);
+    void relayout_hot(const key_type *keys, const uint64_t *hits, size_t n);
+    void advance_generation();
+    void collect(size_t pos, size_t pre, size_t depth, key_type fixed,
+                 size_t bitpos, size_t branch, size_t index, collect_state &state) const;
+
+    build_options m_options;
+    value_map_type m_value_map;
+    size_t m_dead_nodes = 0U;
+    size_t m_dead_leaves = 0U;
+
+    // changes whenever a lookup may return something new; see lookup_cache
+    std::atomic<uint64_t> m_generation{ 0U };
+
+    // whether m_nodes holds a root. Lookups test this rather than the size
+    // of m_nodes, which in-place updates change under them; it is only set
+    // where the node array is replaced, which no in-place update does.
+    bool m_has_root = false;
+
+    // declared first so it outlives the arrays carved from it
+    std::unique_ptr<trie_arena> m_arena;
+    std::unique_ptr<cache_vector<node_type>> m_nodes;
+    std::unique_ptr<data_array> m_data;
+    std::unique_ptr<cache_vector<prefix_type>> m_prefixes;
+    std::unique_ptr<cache_vector<value_type>> m_vals;
+};
+
+// 32-bit nodes addressing up to 1M entries, with up to 64K distinct values
+using lctrie = basic_lctrie<uint32_t, uintptr_t, uint16_t, node_layout<5, 7, 20>>;
+
+// 64-bit nodes for full tables, addressing well past tens of millions of nodes
+using lctrie_full = basic_lctrie<uint32_t, uintptr_t, uint32_t, node_layout<5, 7, 52>>;
+
+// IPv6 routes of /64 or shorter, keyed on the high 64 bits of the address;
+// a 6-bit skip is enough for 64-bit keys, which keeps the nodes at 32 bits
+using lctrie6_64 = basic_lctrie<uint64_t, uintptr_t, uint16_t, node_layout<5, 6, 21>>;
+
+#if defined(LCTRIE_INT128)
+// IPv6 routes of any length, keyed on the whole address
+using lctrie6 = basic_lctrie<lctrie_uint128, uintptr_t, uint16_t, node_layout<5, 7, 20>>;
+#endif
+
+/*
+ * expects (1 <= branch <= 31)
+ * expects (pos >= branch - 1)
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+constexpr uint32_t
+basic_lctrie<K, V, O, L, D, I>::extract(uint8_t pos, uint8_t branch, key_type key)
+{
+    key >>= (pos - (branch - 1));
+    return uint32_t(key & ((key_type(1U) << branch) - 1U));
+}
+
+/*
+ * Returns the mask of the @len leading bits of a key
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+constexpr auto
+basic_lctrie<K, V, O, L, D, I>::prefix_mask(uint8_t len) -> key_type
+{
+    return len == 0U ? key_type(0U) : ~key_type(0U) << (KEY_BITS - len);
+}
+
+/*
+ * Returns true if route @a covers route @b
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+constexpr bool
+basic_lctrie<K, V, O, L, D, I>::is_prefix(const mapped_route &a, const mapped_route &b)
+{
+    return a.len <= b.len && ((a.prefix ^ b.prefix) & prefix_mask(a.len)) == 0U;
+}
+
+/*
+ * Orders routes by prefix, then by length, so a prefix sorts right before
+ * the routes it covers
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+constexpr bool
+basic_lctrie<K, V, O, L, D, I>::route_less(const mapped_route &a, const mapped_route &b)
+{
+    return a.prefix < b.prefix || (a.prefix == b.prefix && a.len < b.len);
+}
+
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+constexpr bool
+basic_lctrie<K, V, O, L, D, I>::route_equal(const mapped_route &a, const mapped_route &b)
+{
+    return a.prefix == b.prefix && a.len == b.len;
+}
+
+/*
+ * Returns the offset of @val in m_vals, appending it on first use
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+inline auto
+basic_lctrie<K, V, O, L, D, I>::intern(const value_type val, value_map_type &map) -> offset_type
+{
+    const auto res = map.emplace(val, offset_type(m_vals->size()));
+
+    if (res.second) {
+        if (m_vals->size() > MAX_OFFSET) {
+            throw std::length_error("lctrie: too many distinct values for offset_type");
+        }
+
+        m_vals->push_back(val);
+    }
+
+    return res.first->second;
+}
+
+/*
+ * Interns the values of the sorted routes and hands them to add_routes().
+ * Values are interned through a hash map, so the pass is linear in the
+ * number of routes. If @values is given, m_vals starts out as a copy of it
+ * and those values keep their offsets. If @offsets is given instead, each
+ * value takes its offset there, in a pool kept outside the trie, and m_vals
+ * stays empty.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::init_map(const route_input_type &routes, const value_input_type *values,
+                                         const value_map_type *offsets)
+{
+    m_data = std::make_unique<data_array>();
+    m_prefixes = std::make_unique<cache_vector<prefix_type>>();
+    m_vals = std::make_unique<cache_vector<value_type>>();
+    m_value_map.clear();
+    m_dead_nodes = 0U;
+    m_dead_leaves = 0U;
+
+    if (values != nullptr) {
+        m_value_map.reserve(values->size());
+        m_vals->reserve(values->size());
+
+        for (const auto val : *values) {
+            intern(val, m_value_map);
+        }
+    }
+
+    mapped_input_type mapped;
+    mapped.reserve(routes.size());
+
+    for (const auto &route : routes) {
+        if (route.len > KEY_BITS) {
+            throw std::invalid_argument("lctrie: prefix length exceeds the key width");
+        }
+
+        const auto prefix = key_type(route.prefix & prefix_mask(route.len));
+
+        // make_node() and find_fork() rely on strictly increasing keys
+        if (!mapped.empty() && !route_less(mapped.back(), { prefix, route.len, 0U })) {
+            throw std::invalid_argument("lctrie: routes must be sorted and unique; see ingest()");
+        }
+
+        if (offsets != nullptr) {
+            const auto offset = offsets->find(route.value);
+
+            if (offset == offsets->end()) {
+                throw std::invalid_argument("lctrie: route value missing from the shared pool");
+            }
+
+            mapped.push_back({ prefix, route.len, offset->second });
+        } else {
+            mapped.push_back({ prefix, route.len, intern(route.value, m_value_map) });
+        }
+    }
+
+    reserve_routes(mapped);
+    add_routes(mapped, NO_PREFIX);
+}
+
+/*
+ * Reserves exactly the base and prefix vector entries the sorted @routes
+ * split into, so add_routes() appends without reallocating
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::reserve_routes(const mapped_input_type &routes)
+{
+    auto prefixes = size_t(0U);
+
+    for (auto i = size_t(1U); i < routes.size(); ++i) {
+        prefixes += is_prefix(routes[i - 1U], routes[i]) ? 1U : 0U;
+    }
+
+    m_data->reserve(m_data->size() + routes.size() - prefixes);
+    m_prefixes->reserve(m_prefixes->size() + prefixes);
+}
+
+/*
+ * Splits the sorted routes into the base vector (m_data) and the prefix
+ * vector (m_prefixes), as in Nilsson and Karlsson. A route that covers the
+ * route after it is a prefix; since the input is sorted, it then covers a
+ * contiguous run of later routes. Every entry keeps the index of the longest
+ * prefix that covers it in pre, so a leaf whose own compare fails can fall
+ * back through its enclosing prefixes without walking the trie again.
+ *
+ * Entries are appended, and chains end at @outer rather than NO_PREFIX, so
+ * the routes of one slot can be added under prefixes already stored.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::add_routes(const mapped_input_type &routes, const pre_type outer)
+{
+    open_prefixes open;
+
+    for (auto i = size_t(0U); i < routes.size(); ++i) {
+        add_route(routes[i], i + 1U < routes.size() ? &routes[i + 1U] : nullptr, open, outer);
+    }
+
+    check_routes();
+}
+
+/*
+ * Appends one route of a sorted run, given the route after it (@next, or
+ * nullptr at the end of the run), which is all add_routes() looks ahead
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+inline void
+basic_lctrie<K, V, O, L, D, I>::add_route(const mapped_route &route, const mapped_route *next,
+                                          open_prefixes &open, const pre_type outer)
+{
+    while (!open.empty() && !is_prefix(open.back().first, route)) {
+        open.pop_back();
+    }
+
+    const auto pre = open.empty() ? outer : open.back().second;
+
+    if (next != nullptr && is_prefix(route, *next)) {
+        open.push_back({ route, pre_type(m_prefixes->size()) });
+        m_prefixes->push_back({ route.len, route.offset, pre });
+    } else {
+        m_data->push_back({ route.prefix, route.len, route.offset, pre });
+    }
+}
+
+/*
+ * Throws std::length_error if the base or prefix vector outgrew the
+ * fields that index it
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::check_routes() const
+{
+    if (m_data->size() > MAX_NEXT + 1U) {
+        throw std::length_error("lctrie: too many routes for the next field");
+    }
+
+    if (m_prefixes->size() >= NO_PREFIX) {
+        throw std::length_error("lctrie: too many prefixes for pre_type");
+    }
+}
+
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::init_trie()
+{
+    advance_generation();
+    m_has_root = false;
+    m_nodes = std::make_unique<cache_vector<node_type>>();
+
+    if (m_data->empty()) {
+        return;
+    }
+
+    const auto nkeys = m_data->size();
+    const auto threads = thread_count();
+
+    m_nodes->resize(1U);
+
+    if (threads == 1U || nkeys < 2U * BUILD_GRAIN) {
+        // a forced root branch may add up to 2^root_branch empty slots
+        m_nodes->reserve(max_nodes(nkeys) + (size_t(1U) << m_options.root_branch));
+        make_node(*m_nodes, 0U, nkeys, 0U, 0U, m_options.root_branch, nullptr);
+    } else {
+        // several tasks per thread keep the workers busy when subtries
+        // differ in size
+        build_split split = { {}, std::max(BUILD_GRAIN, nkeys / (8U * threads)) };
+
+        make_node(*m_nodes, 0U, nkeys, 0U, 0U, m_options.root_branch, &split);
+        build_parallel(split.tasks, threads);
+    }
+
+    m_has_root = true;
+
+    if (m_options.order != node_order::depth_first) {
+        // moves the nodes into the arena as well
+        relayout(m_options.order);
+    } else if (m_options.arena || m_options.huge_pages || m_options.numa_node >= 0) {
+        move_to_arena(0.0);
+    }
+}
+
+/*
+ * Moves the four arrays into one new arena, each with room to grow by
+ * @headroom of its size. A lookup then touches one contiguous range, which
+ * with huge pages is a few TLB entries. Growing an array past its room
+ * later moves it back to the heap.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::move_to_arena(const double headroom)
+{
+    const auto grow = [headroom](const size_t n) {
+        return n + size_t(double(n) * headroom);
+    };
+
+    copy_to_arena(*this, grow(m_nodes->size()), grow(m_data->size()), grow(m_prefixes->size()),
+                  grow(m_vals->size()));
+}
+
+/*
+ * Replaces the arrays with copies of those of @from, which may be this
+ * trie, in one new arena that holds @nodes, @leaves, @prefixes and @values
+ * entries of each
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::copy_to_arena(const basic_lctrie &from, const size_t nodes,
+                                              const size_t leaves, const size_t prefixes,
+                                              const size_t values)
+{
+    auto arena = std::make_unique<trie_arena>(
+        trie_arena::footprint<node_type>(nodes) + data_array::footprint(leaves) +
+            trie_arena::footprint<prefix_type>(prefixes) + trie_arena::footprint<value_type>(values),
+        m_options.huge_pages, m_options.numa_node);
+
+    auto node_copy = std::make_unique<cache_vector<node_type>>(cache_allocator<node_type>(arena.get()));
+    auto data_copy = std::make_unique<data_array>(arena.get());
+    auto prefix_copy = std::make_unique<cache_vector<prefix_type>>(cache_allocator<prefix_type>(arena.get()));
+    auto value_copy = std::make_unique<cache_vector<value_type>>(cache_allocator<value_type>(arena.get()));
+
+    node_copy->reserve(nodes);
+    node_copy->assign(from.m_nodes->begin(), from.m_nodes->end());
+    data_copy->assign(*from.m_data, leaves);
+    prefix_copy->reserve(prefixes);
+    prefix_copy->assign(from.m_prefixes->begin(), from.m_prefixes->end());
+    value_copy->reserve(values);
+    value_copy->assign(from.m_vals->begin(), from.m_vals->end());
+
+    m_nodes = std::move(node_copy);
+    m_data = std::move(data_copy);
+    m_prefixes = std::move(prefix_copy);
+    m_vals = std::move(value_copy);
+    m_arena = std::move(arena);
+    m_has_root = !m_nodes->empty();
+}
+
+/*
+ * Builds the deferred subtries of a parallel build. Workers take tasks,
+ * largest first, from a shared cursor and build each into a block of its
+ * own, rooted at the block's first node. The blocks are then appended to
+ * m_nodes, starting on a cache line when aligning children so the layout
+ * inside them holds, with their next fields rebased; each task's slot gets
+ * a copy of its block's root.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::build_parallel(const std::vector<build_task> &tasks, const unsigned threads)
+{
+    std::vector<cache_vector<node_type>> blocks(tasks.size());
+    std::vector<std::exception_ptr> errors(tasks.size());
+    std::vector<size_t> order(tasks.size());
+    std::atomic<size_t> cursor{ 0U };
+
+    for (auto i = size_t(0U); i < order.size(); ++i) {
+        order[i] = i;
+    }
+
+    std::sort(order.begin(), order.end(), [&tasks](const size_t a, const size_t b) {
+        return tasks[a].nkeys > tasks[b].nkeys;
+    });
+
+    const auto work = [&](unsigned) {
+        for (auto i = cursor.fetch_add(1U); i < order.size(); i = cursor.fetch_add(1U)) {
+            const auto &task = tasks[order[i]];
+            auto &block = blocks[order[i]];
+
+            try {
+                block.resize(1U);
+                make_node(block, task.first, task.nkeys, task.pre, 0U, 0U, nullptr);
+            } catch (...) {
+                errors[order[i]] = std::current_exception();
+            }
+        }
+    };
+
+    run_threads(unsigned(std::min(size_t(threads), tasks.size())), work);
+
+    for (const auto &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    std::vector<size_t> offsets(tasks.size());
+    auto size = m_nodes->size();
+
+    for (auto i = size_t(0U); i < tasks.size(); ++i) {
+        offsets[i] = align_block(size, MAX_BRANCH);
+        size = offsets[i] + blocks[i].size();
+    }
+
+    if (size - 1U > MAX_NEXT) {
+        throw std::length_error("lctrie: too many nodes for the next field");
+    }
+
+    m_nodes->resize(size);
+
+    for (auto i = size_t(0U); i < tasks.size(); ++i) {
+        auto out = m_nodes->begin() + std::ptrdiff_t(offsets[i]);
+
+        for (auto node : blocks[i]) {
+            if (node.branch != 0U) {
+                node.next += offsets[i];
+            }
+
+            *out++ = node;
+        }
+
+        publish_node(*m_nodes, tasks[i].pos, (*m_nodes)[offsets[i]]);
+    }
+}
+
+/*
+ * Hints that @ptr will be read soon
+ */
+inline void prefetch(const void *ptr)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(ptr, 0, 3);
+#else
+    (void)ptr;
+#endif
+}
+
+enum class simd_level {
+    none,
+    avx2,
+    avx512
+};
+
+/*
+ * Returns the widest vector kernel the running CPU supports
+ */
+inline simd_level detect_simd()
+{
+#if defined(LCTRIE_X86_SIMD)
+    static const auto level =
+        __builtin_cpu_supports("avx512f") ? simd_level::avx512 :
+        __builtin_cpu_supports("avx2") ? simd_level::avx2 : simd_level::none;
+
+    return level;
+#else
+    return simd_level::none;
+#endif
+}
+
+/*
+ * Returns the number of leading zero bits of @diff, which is all of its
+ * bits when @diff is 0. The implementation is picked at compile time:
+ * std::countl_zero where the library has it, then lzcnt or the compiler
+ * builtin, and finally a bit-at-a-time loop.
+ */
+template <typename T>
+inline size_t high_zero_count(T diff)
+{
+    [[maybe_unused]] constexpr auto bits = 8U * sizeof(T);
+
+#if defined(__cpp_lib_bitops)
+    return size_t(std::countl_zero(diff));
+#elif defined(__LZCNT__)
+    if constexpr (bits <= 32U) {
+        return _lzcnt_u32(uint32_t(diff)) - (32U - bits);
+    } else {
+        return _lzcnt_u64(uint64_t(diff)) - (64U - bits);
+    }
+#elif defined(__GNUC__)
+    if (diff == 0U) {
+        return bits;
+    }
+
+    if constexpr (bits <= 32U) {
+        return __builtin_clz(uint32_t(diff)) - (32U - bits);
+    } else {
+        return __builtin_clzll(uint64_t(diff)) - (64U - bits);
+    }
+#else
+    constexpr auto high_bit = T(1U) << (bits - 1U);
+    size_t count = 0U;
+
+    while (count < bits && (diff & high_bit) == 0U) {
+        ++count;
+        diff <<= 1U;
+    }
+
+    return count;
+#endif
+}
+
+#if defined(LCTRIE_INT128)
+/*
+ * Counts over the two 64-bit words of a 128-bit key, high word first
+ */
+inline size_t high_zero_count(const lctrie_uint128 diff)
+{
+    const auto high = uint64_t(diff >> 64U);
+
+    return high != 0U ? high_zero_count(high) : 64U + high_zero_count(uint64_t(diff));
+}
+#endif
+
+/*
+ * An instrumentation policy that counts what lookups do, per thread, and
+ * times one lookup() in 2^SAMPLE_SHIFT of each thread into a histogram of
+ * log2 ticks. A thread only ever writes its own block of counters, with
+ * relaxed stores, so lookups never contend; snapshot() sums the blocks of
+ * every thread that has looked up, including those that have exited. A
+ * block lives as long as the process.
+ */
+struct lookup_counters {
+    static constexpr bool ENABLED = true;
+    static constexpr unsigned SAMPLE_SHIFT = 10U;
+    static constexpr size_t BUCKETS = 64U;
+
+    struct snapshot_type {
+        uint64_t lookups;
+        uint64_t levels;
+        uint64_t skip_failures;
+        uint64_t fallbacks;
+        uint64_t misses;
+
+        // latency[b] timed lookups took [2^b, 2^(b+1)) ticks, which are
+        // TSC cycles on x86 and steady_clock ticks elsewhere
+        std::array<uint64_t, BUCKETS> latency;
+    };
+
+    struct alignas(64) block {
+        std::atomic<uint64_t> lookups{ 0U };
+        std::atomic<uint64_t> levels{ 0U };
+        std::atomic<uint64_t> skip_failures{ 0U };
+        std::atomic<uint64_t> fallbacks{ 0U };
+        std::atomic<uint64_t> misses{ 0U };
+        std::array<std::atomic<uint64_t>, BUCKETS> latency = {};
+
+        // lookups until the next timed one; only the owner touches it
+        uint64_t countdown = 0U;
+    };
+
+    static void walk(const size_t lookups, const size_t levels)
+    {
+        auto &counters = local();
+        add(counters.lookups, lookups);
+        add(counters.levels, levels);
+    }
+
+    static void skip_failure() { add(local().skip_failures, 1U); }
+    static void fallback() { add(local().fallbacks, 1U); }
+    static void miss() { add(local().misses, 1U); }
+
+    static bool sample();
+    static uint64_t ticks();
+    static void latency(uint64_t ticks);
+    static snapshot_type snapshot();
+
+    static block &local();
+
+    // the owner is the only writer, so a load and a store do for an add
+    static void add(std::atomic<uint64_t> &counter, const uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static std::mutex &registry_lock();
+    static std::vector<std::unique_ptr<block>> &registry();
+};
+
+inline std::mutex &
+lookup_counters::registry_lock()
+{
+    static std::mutex lock;
+    return lock;
+}
+
+inline std::vector<std::unique_ptr<lookup_counters::block>> &
+lookup_counters::registry()
+{
+    static std::vector<std::unique_ptr<block>> blocks;
+    return blocks;
+}
+
+/*
+ * Returns the block of the calling thread, registering it on first use
+ */
+inline lookup_counters::block &
+lookup_counters::local()
+{
+    thread_local block *counters = nullptr;
+
+    if (counters == nullptr) {
+        auto fresh = std::make_unique<block>();
+        std::lock_guard<std::mutex> guard(registry_lock());
+
+        counters = fresh.get();
+        registry().push_back(std::move(fresh));
+    }
+
+    return *counters;
+}
+
+inline bool
+lookup_counters::sample()
+{
+    auto &counters = local();
+
+    if (counters.countdown != 0U) {
+        --counters.countdown;
+        return false;
+    }
+
+    counters.countdown = (uint64_t(1U) << SAMPLE_SHIFT) - 1U;
+    return true;
+}
+
+inline uint64_t
+lookup_counters::ticks()
+{
+#if defined(LCTRIE_X86_SIMD)
+    return __rdtsc();
+#else
+    return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+inline void
+lookup_counters::latency(const uint64_t ticks)
+{
+    const auto bucket = ticks == 0U ? 0U : 63U - high_zero_count(ticks);
+    add(local().latency[bucket], 1U);
+}
+
+inline auto
+lookup_counters::snapshot() -> snapshot_type
+{
+    snapshot_type total = {};
+    std::lock_guard<std::mutex> guard(registry_lock());
+
+    for (const auto &counters : registry()) {
+        total.lookups += counters->lookups.load(std::memory_order_relaxed);
+        total.levels += counters->levels.load(std::memory_order_relaxed);
+        total.skip_failures += counters->skip_failures.load(std::memory_order_relaxed);
+        total.fallbacks += counters->fallbacks.load(std::memory_order_relaxed);
+        total.misses += counters->misses.load(std::memory_order_relaxed);
+
+        for (auto b = size_t(0U); b < BUCKETS; ++b) {
+            total.latency[b] += counters->latency[b].load(std::memory_order_relaxed);
+        }
+    }
+
+    return total;
+}
+
+/*
+ * The skip is computed by XOR'ing the first and last elements of the range.
+ * Since the range is sorted, if these two values have leading bits in common,
+ * then every value in between will have those bits in common. The skip is
+ * number of leading zeros before the first '1' of the XOR value, not counting
+ * the @pre leading bits
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+size_t
+basic_lctrie<K, V, O, L, D, I>::compute_skip(
+    const size_t first,
+    const size_t nkeys,
+    const size_t pre) const
+{
+    if (pre >= KEY_BITS) {
+        return 0U;
+    }
+
+    const auto last = first + nkeys - 1;
+    const auto diff = (m_data->key(first) ^ m_data->key(last));
+
+    return std::min(high_zero_count(key_type(diff << pre)), size_t(KEY_BITS - pre));
+}
+
+/*
+ * Returns the index of the first key in [first, last) whose bit at
+ * (suffix_len - 1) is set. Every key in the range must share the bits
+ * above the suffix, so the sort order puts all the clear keys first.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+size_t
+basic_lctrie<K, V, O, L, D, I>::find_fork(
+    const size_t first,
+    const size_t last,
+    const size_t suffix_len) const
+{
+    const auto mask = key_type(1U) << (suffix_len - 1U);
+    const auto fork = (m_data->key(first) & ~(mask | (mask - 1U))) | mask;
+    auto lo = first;
+    auto hi = last;
+
+    while (lo < hi) {
+        const auto mid = lo + (hi - lo) / 2U;
+
+        if (m_data->key(mid) < fork) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*
+ * branch is bounded below by 1 and above by the
+ * min(# remaining bits, floor(log(# of keys)))
+ *
+ * We proceed by examining the two leftmost bits of
+ * first and last. If first = 01xxxxxx, then we can't
+ * have a branch of more than 1. This is because the list
+ * is sorted, and therefore 00xxxxx cannot occur after
+ * 01xxxxx, and thus the range covers at most 3 two-bit
+ * values. The case where last = 10xxxxxx is similar
+ *
+ * In general, every range is split at its fork for the
+ * next bit, and each non-empty half is one of the 2^b
+ * children a branch of b bits would have. With a fill
+ * factor of 1 the branch grows as long as every range
+ * forks into two non-empty halves; with a lower fill
+ * factor it grows as long as at least that fraction of
+ * the children are non-empty, and make_node() points the
+ * empty ones at their nearest leaf.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+size_t
+basic_lctrie<K, V, O, L, D, I>::compute_branch(
+    const size_t first,
+    const size_t nkeys,
+    const size_t pre) const
+{
+    std::vector<std::pair<size_t, size_t>> ranges = { { first, first + nkeys } };
+    std::vector<std::pair<size_t, size_t>> forks;
+    auto suffix_len = KEY_BITS - pre;
+    auto branch = 0U;
+
+    while (suffix_len > 0U && branch < MAX_BRANCH) {
+        forks.clear();
+
+        for (const auto &range : ranges) {
+            const auto fork = find_fork(range.first, range.second, suffix_len);
+
+            if (fork != range.first) {
+                forks.push_back({ range.first, fork });
+            }
+
+            if (fork != range.second) {
+                forks.push_back({ fork, range.second });
+            }
+        }
+
+        const auto children = double(size_t(1U) << (branch + 1U));
+
+        if (branch != 0U && double(forks.size()) < m_options.fill_factor * children) {
+            break;
+        }
+
+        ranges.swap(forks);
+        ++branch;
+        --suffix_len;
+    }
+
+    return branch;
+}
+
+/*
+ * Returns where a block of 2^@branch children should start if m_nodes ends
+ * at @next. With align_children, the block is aligned to its own size up
+ * to a cache line, so it never straddles two lines; the nodes skipped over
+ * are padding.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+size_t
+basic_lctrie<K, V, O, L, D, I>::align_block(const size_t next, const size_t branch) const
+{
+    if (!m_options.align_children) {
+        return next;
+    }
+
+    constexpr auto line = std::max(size_t(1U), cache_allocator<node_type>::ALIGN / sizeof(node_type));
+    const auto align = std::min(line, size_t(1U) << branch);
+
+    return (next + align - 1U) / align * align;
+}
+
+/*
+ * Returns the leaf an empty child slot should point at. The slot covers the
+ * keys starting with the @len leading bits of @slot, and @pos is where such
+ * keys would sit in the sorted range [first, last). Of the two neighbours,
+ * the one sharing more leading bits with the slot carries every prefix that
+ * also covers the slot in its chain, so a lookup that fails its compare
+ * still finds the right enclosing prefix.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+size_t
+basic_lctrie<K, V, O, L, D, I>::nearest_leaf(
+    const size_t first,
+    const size_t last,
+    const size_t pos,
+    const key_type slot,
+    const size_t len) const
+{
+    const auto match = [&](const size_t i) {
+        return std::min(high_zero_count(key_type(m_data->key(i) ^ slot)), len);
+    };
+
+    if (pos == last || (pos > first && match(pos - 1U) > match(pos))) {
+        return pos - 1U;
+    }
+
+    return pos;
+}
+
+/*
+ * Builds the node at @pos of @nodes for the @nkeys sorted keys starting at
+ * @first, all of which share their @pre leading bits. The children of an
+ * internal node are allocated as one contiguous block at the end of @nodes,
+ * so a lookup only needs the block base (next) plus the extracted branch
+ * bits. A non-zero @branch forces the node to branch on that many bits
+ * without a skip, as root_branch asks of the root.
+ *
+ * With @split, subtries of at most split->grain keys are not built but
+ * queued for build_parallel().
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::make_node(
+    cache_vector<node_type> &nodes,
+    size_t first,
+    const size_t nkeys,
+    const size_t pre,
+    const size_t pos,
+    const size_t branch_bits,
+    build_split *split)
+{
+    if (nkeys == 1U) {
+        publish_node(nodes, pos, { 0U, 0U, node_storage(first) });
+        return;
+    }
+
+    const auto forced = branch_bits != 0U;
+    const auto skip = forced ? 0U : compute_skip(first, nkeys, pre);
+    const auto branch = forced ? branch_bits : compute_branch(first, nkeys, pre + skip);
+    const auto next = align_block(nodes.size(), branch);
+    const auto bitpos = KEY_BITS - 1U - (pre + skip);
+    const auto depth = pre + skip + branch;
+    const auto base = m_data->key(first) & prefix_mask(uint8_t(pre + skip));
+    const auto lo = first;
+    const auto last = first + nkeys;
+
+    if (next + (1U << branch) - 1U > MAX_NEXT) {
+        throw std::length_error("lctrie: too many nodes for the next field");
+    }
+
+    nodes.resize(next + (1U << branch));
+
+    for (auto pattern = 0U; pattern < (1U << branch); ++pattern) {
+        auto count = 0U;
+
+        while (first + count < last &&
+               extract(bitpos, branch, m_data->key(first + count)) == pattern) {
+            ++count;
+        }
+
+        if (count == 0U) {
+            const auto slot = base | (key_type(pattern) << (KEY_BITS - depth));
+            const auto leaf = nearest_leaf(lo, last, first, slot, depth);
+            nodes[next + pattern] = { 0U, 0U, node_storage(leaf) };
+            continue;
+        }
+
+        if (split != nullptr && count <= split->grain && count >= split->grain / 64U) {
+            split->tasks.push_back({ first, count, depth, next + pattern });
+        } else {
+            make_node(nodes, first, count, depth, next + pattern, 0U, split);
+        }
+
+        first += count;
+    }
+
+    publish_node(nodes, pos, { node_storage(branch), node_storage(skip), node_storage(next) });
+}
+
+/*
+ * Stores @node at @pos of @nodes. make_node() stores a node only once the
+ * block and leaves below it are complete, and the store is a release that
+ * the acquire in load_node() pairs with, so a lookup running during
+ * try_insert() or try_erase() sees either the old slot or the whole new
+ * subtrie.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+inline void
+basic_lctrie<K, V, O, L, D, I>::publish_node(cache_vector<node_type> &nodes, const size_t pos, node_type node)
+{
+#if defined(__GNUC__)
+    __atomic_store(&nodes[pos], &node, __ATOMIC_RELEASE);
+#else
+    std::atomic_thread_fence(std::memory_order_release);
+    nodes[pos] = node;
+#endif
+}
+
+/*
+ * Returns a bound on the nodes make_node() appends for @nkeys leaves. A
+ * node with c non-empty children has at most c / fill_factor of them, the
+ * children counted over the whole subtrie add up to less than 2 * nkeys,
+ * and aligning a block pads it by less than a cache line of nodes.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+size_t
+basic_lctrie<K, V, O, L, D, I>::max_nodes(const size_t nkeys) const
+{
+    constexpr auto line = std::max(size_t(1U), cache_allocator<node_type>::ALIGN / sizeof(node_type));
+    const auto children = size_t(double(2U * nkeys) / m_options.fill_factor) + 1U;
+
+    return children + (m_options.align_children ? nkeys * line : 0U);
+}
+
+/*
+ * Returns the value of the longest prefix matching @key among the @leaf
+ * entry of m_data and its chain of enclosing prefixes.
+ *
+ * The leaf is compared on its own prefix length; on a mismatch the lookup
+ * falls back through the leaf's enclosing prefixes, all of which share the
+ * leaf's leading bits, so the same XOR is checked against each length.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+template <typename Leaves>
+constexpr auto
+basic_lctrie<K, V, O, L, D, I>::find_leaf(const table_view<Leaves> &t, const size_t leaf, const key_type key)
+    -> value_type
+{
+    const auto diff = t.leaves->diff(leaf, key);
+
+    if ((diff & prefix_mask(t.leaves->len(leaf))) == 0U) {
+        return t.vals[t.leaves->offset(leaf)];
+    }
+
+    instrument_type::skip_failure();
+
+    for (auto pre = t.leaves->pre(leaf); pre != NO_PREFIX; pre = t.prefixes[pre].pre) {
+        const auto &prefix = t.prefixes[pre];
+
+        instrument_type::fallback();
+
+        if ((diff & prefix_mask(prefix.len)) == 0U) {
+            return t.vals[prefix.offset];
+        }
+    }
+
+    instrument_type::miss();
+    return NO_VALUE;
+}
+
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+inline auto
+basic_lctrie<K, V, O, L, D, I>::lookup_leaf(const size_t leaf, const key_type key) const -> value_type
+{
+    return find_leaf(tables(), leaf, key);
+}
+
+/*
+ * Returns the arrays of this trie as lookups read them; expects a built trie
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+inline auto
+basic_lctrie<K, V, O, L, D, I>::tables() const -> table_view<data_array>
+{
+    return { m_nodes->data(), m_data.get(), m_prefixes->data(), m_vals->data() };
+}
+
+/*
+ * Loads @slot as a lookup reads it. try_insert() and try_erase() publish
+ * slots with a release store while lookups run, so this is an acquire
+ * load that pairs with publish_node(): a lookup that reads the new slot
+ * also sees the subtrie and leaves below it. On x86 it is a plain load. A
+ * constant evaluation, which static_lctrie runs, reads the slot directly.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+constexpr auto
+basic_lctrie<K, V, O, L, D, I>::load_node(const node_type &slot) -> node_type
+{
+#if defined(__GNUC__)
+    if (!__builtin_is_constant_evaluated()) {
+        node_type node = {};
+
+        __atomic_load(&slot, &node, __ATOMIC_ACQUIRE);
+        return node;
+    }
+#endif
+
+    return slot;
+}
+
+/*
+ * pos tracks the most significant bit that has not been consumed yet. Each
+ * level skips and extracts unconditionally, so the only branch in the walk
+ * is the loop exit on the node just loaded. A node is a single storage word,
+ * so each level touches exactly one cache line of m_nodes.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+template <typename Leaves>
+constexpr auto
+basic_lctrie<K, V, O, L, D, I>::find(const table_view<Leaves> &t, const key_type key) -> value_type
+{
+    return find(t, load_node(t.nodes[0]), key);
+}
+
+/*
+ * As above, from a copy of the root kept outside t.nodes
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+template <typename Leaves>
+constexpr auto
+basic_lctrie<K, V, O, L, D, I>::find(const table_view<Leaves> &t, const node_type root, const key_type key)
+    -> value_type
+{
+    const auto nodes = t.nodes;
+    auto node = root;
+    auto pos = KEY_BITS - 1U;
+    auto levels = size_t(1U);
+
+    while (node.branch != 0U) {
+        pos -= node.skip;
+        const auto next = node.next + extract(pos, node.branch, key);
+        pos -= node.branch;
+        node = load_node(nodes[next]);
+        ++levels;
+    }
+
+    instrument_type::walk(1U, levels);
+    return find_leaf(t, node.next, key);
+}
+
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::lookup(const key_type key) const -> value_type
+{
+    if (!m_has_root) {
+        return NO_VALUE;
+    }
+
+    if constexpr (instrument_type::ENABLED) {
+        if (instrument_type::sample()) {
+            const auto start = instrument_type::ticks();
+            const auto value = find(tables(), key);
+
+            instrument_type::latency(instrument_type::ticks() - start);
+            return value;
+        }
+    }
+
+    return find(tables(), key);
+}
+
+/*
+ * Looks up @n keys into @out with the widest kernel the CPU supports,
+ * falling back to the scalar one when the layout does not allow vectors
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::lookup_batch(
+    const key_type *keys,
+    value_type *out,
+    const size_t n) const
+{
+    if (!m_has_root) {
+        std::fill_n(out, n, NO_VALUE);
+        return;
+    }
+
+    // the leaves in use only grow within their capacity while lookups run
+    find_batch_widest(tables(), data_array::footprint(m_data->capacity()), keys, out, n);
+}
+
+/*
+ * The kernel dispatch of lookup_batch(), for any arrays laid out like a
+ * trie's, such as a mapped image; @leaf_bytes is the size of the leaves
+ * the gathers index
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+template <typename Leaves>
+void
+basic_lctrie<K, V, O, L, D, I>::find_batch_widest(
+    const table_view<Leaves> &t,
+    [[maybe_unused]] const size_t leaf_bytes,
+    const key_type *keys,
+    value_type *out,
+    const size_t n)
+{
+#if defined(LCTRIE_X86_SIMD)
+    // the vector kernels have no hooks, so an instrumented trie skips them
+    if constexpr (SIMD_LAYOUT && !instrument_type::ENABLED) {
+        // gathers take signed 32-bit byte offsets into the leaves
+        if (leaf_bytes <= size_t(INT32_MAX)) {
+            switch (detect_simd()) {
+            case simd_level::avx512:
+                return find_batch_avx512(t, keys, out, n);
+            case simd_level::avx2:
+                return find_batch_avx2(t, keys, out, n);
+            case simd_level::none:
+                break;
+            }
+        }
+    }
+#endif
+
+    find_batch(t, keys, out, n);
+}
+
+/*
+ * The keys are walked BATCH_SIZE at a time in lockstep: every pass first
+ * computes and prefetches the next node of each unfinished key, then loads
+ * them all, so the cache misses of the keys in a batch overlap instead of
+ * being paid one after the other. The leaves are prefetched the same way
+ * before they are compared.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::lookup_batch_scalar(
+    const key_type *keys,
+    value_type *out,
+    const size_t n) const
+{
+    if (!m_has_root) {
+        std::fill_n(out, n, NO_VALUE);
+        return;
+    }
+
+    find_batch(tables(), keys, out, n);
+}
+
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+template <typename Leaves>
+void
+basic_lctrie<K, V, O, L, D, I>::find_batch(
+    const table_view<Leaves> &t,
+    const key_type *keys,
+    value_type *out,
+    const size_t n)
+{
+    const auto nodes = t.nodes;
+
+    for (size_t first = 0U; first < n; first += BATCH_SIZE) {
+        const auto count = std::min(BATCH_SIZE, n - first);
+        node_type node[BATCH_SIZE];
+        size_t next[BATCH_SIZE];
+        unsigned pos[BATCH_SIZE];
+        auto active = true;
+        auto levels = count;
+
+        for (size_t i = 0U; i < count; ++i) {
+            node[i] = load_node(nodes[0]);
+            next[i] = 0U;
+            pos[i] = KEY_BITS - 1U;
+        }
+
+        while (active) {
+            active = false;
+
+            for (size_t i = 0U; i < count; ++i) {
+                if (node[i].branch != 0U) {
+                    pos[i] -= node[i].skip;
+                    next[i] = node[i].next + extract(pos[i], node[i].branch, keys[first + i]);
+                    pos[i] -= node[i].branch;
+                    prefetch(&nodes[next[i]]);
+                    active = true;
+                    ++levels;
+                }
+            }
+
+            // a lane at its leaf keeps the node it read, since a concurrent
+            // update may have published a subtrie in that slot since
+            for (size_t i = 0U; i < count; ++i) {
+                if (node[i].branch != 0U) {
+                    node[i] = load_node(nodes[next[i]]);
+                }
+            }
+        }
+
+        instrument_type::walk(count, levels);
+
+        for (size_t i = 0U; i < count; ++i) {
+            prefetch(t.leaves->address(node[i].next));
+        }
+
+        for (size_t i = 0U; i < count; ++i) {
+            out[first + i] = find_leaf(t, node[i].next, keys[first + i]);
+        }
+    }
+}
+
+#if defined(LCTRIE_X86_SIMD)
+
+/*
+ * The AVX2 kernel on this trie's arrays; an empty trie gives NO_VALUE
+ * for every key, as lookup_batch() does
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+__attribute__((target("avx2")))
+void
+basic_lctrie<K, V, O, L, D, I>::lookup_batch_avx2(
+    const key_type *keys,
+    value_type *out,
+    const size_t n) const
+{
+    if (!m_has_root) {
+        std::fill_n(out, n, NO_VALUE);
+        return;
+    }
+
+    find_batch_avx2(tables(), keys, out, n);
+}
+
+/*
+ * The vector kernels keep one key per 32-bit lane. A node is gathered as
+ * its whole storage word and split with shifts, since the x86-64 ABI lays
+ * bit-fields out from the least significant bit in declaration order. The
+ * extract() shift and mask become variable shifts; lanes that reached a
+ * leaf have branch = skip = 0, so they extract nothing and are masked out
+ * of the gather. The leaves are then gathered and compared on their prefix
+ * length in vector form, and only lanes that miss their leaf fall back to
+ * the scalar prefix chain.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+template <typename Leaves>
+__attribute__((target("avx2")))
+void
+basic_lctrie<K, V, O, L, D, I>::find_batch_avx2(
+    const table_view<Leaves> &t,
+    const key_type *keys,
+    value_type *out,
+    const size_t n)
+{
+    constexpr auto BRANCH_BITS = int(layout_type::BRANCH_BITS);
+    constexpr auto NEXT_SHIFT = int(layout_type::BRANCH_BITS + layout_type::SKIP_BITS);
+    constexpr auto OFFSET_MASK = sizeof(offset_type) < 4U ?
+        int((1U << (8U * sizeof(offset_type))) - 1U) : -1;
+
+    const auto nodes = reinterpret_cast<const int *>(t.nodes);
+    const auto key_field = t.leaves->key_field();
+    const auto len_field = t.leaves->len_field();
+    const auto offset_field = t.leaves->offset_field();
+    const auto data_key = reinterpret_cast<const int *>(key_field.base);
+    const auto data_len = reinterpret_cast<const int *>(len_field.base);
+    const auto data_offset = reinterpret_cast<const int *>(offset_field.base);
+
+    // the gathers below read the slots as plain words; x86 loads each one
+    // whole, and in order after the root the way load_node() would
+    const auto root_node = load_node(t.nodes[0]);
+    int root;
+    std::memcpy(&root, &root_node, sizeof(root));
+
+    const auto zero = _mm256_setzero_si256();
+    const auto ones = _mm256_set1_epi32(1);
+    const auto all = _mm256_set1_epi32(-1);
+    const auto branch_mask = _mm256_set1_epi32((1 << BRANCH_BITS) - 1);
+    const auto skip_mask = _mm256_set1_epi32((1 << layout_type::SKIP_BITS) - 1);
+    const auto key_stride = _mm256_set1_epi32(int(key_field.stride));
+    const auto len_stride = _mm256_set1_epi32(int(len_field.stride));
+    const auto offset_stride = _mm256_set1_epi32(int(offset_field.stride));
+    size_t first = 0U;
+
+    for (; first + 8U <= n; first += 8U) {
+        const auto key = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + first));
+        auto word = _mm256_set1_epi32(root);
+        auto pos = _mm256_set1_epi32(int(KEY_BITS - 1U));
+
+        for (;;) {
+            const auto branch = _mm256_and_si256(word, branch_mask);
+            const auto leaf = _mm256_cmpeq_epi32(branch, zero);
+
+            if (_mm256_movemask_epi8(leaf) == -1) {
+                break;
+            }
+
+            const auto skip = _mm256_and_si256(_mm256_srli_epi32(word, BRANCH_BITS), skip_mask);
+            pos = _mm256_sub_epi32(pos, skip);
+
+            const auto shift = _mm256_add_epi32(_mm256_sub_epi32(pos, branch), ones);
+            const auto mask = _mm256_sub_epi32(_mm256_sllv_epi32(ones, branch), ones);
+            const auto bits = _mm256_and_si256(_mm256_srlv_epi32(key, shift), mask);
+            const auto next = _mm256_add_epi32(_mm256_srli_epi32(word, NEXT_SHIFT), bits);
+
+            word = _mm256_mask_i32gather_epi32(word, nodes, next, _mm256_xor_si256(leaf, all), 4);
+            pos = _mm256_sub_epi32(pos, branch);
+        }
+
+        const auto index = _mm256_srli_epi32(word, NEXT_SHIFT);
+        const auto leaf_key = _mm256_i32gather_epi32(data_key, _mm256_mullo_epi32(index, key_stride), 1);
+        const auto leaf_len = _mm256_and_si256(
+            _mm256_i32gather_epi32(data_len, _mm256_mullo_epi32(index, len_stride), 1), _mm256_set1_epi32(0xFF));
+        const auto prefix = _mm256_sllv_epi32(
+            all, _mm256_sub_epi32(_mm256_set1_epi32(int(KEY_BITS)), leaf_len));
+        const auto diff = _mm256_and_si256(_mm256_xor_si256(key, leaf_key), prefix);
+        const auto hits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(diff, zero)));
+        const auto offset = _mm256_and_si256(
+            _mm256_i32gather_epi32(data_offset, _mm256_mullo_epi32(index, offset_stride), 1), _mm256_set1_epi32(OFFSET_MASK));
+
+        alignas(32) uint32_t lane_index[8];
+        alignas(32) uint32_t lane_offset[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lane_index), index);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lane_offset), offset);
+
+        for (auto i = 0U; i < 8U; ++i) {
+            out[first + i] = (hits >> i) & 1 ?
+                t.vals[lane_offset[i]] : find_leaf(t, lane_index[i], keys[first + i]);
+        }
+    }
+
+    find_batch(t, keys + first, out + first, n - first);
+}
+
+/*
+ * The AVX-512 kernel on this trie's arrays; an empty trie gives NO_VALUE
+ * for every key, as lookup_batch() does
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+__attribute__((target("avx512f")))
+void
+basic_lctrie<K, V, O, L, D, I>::lookup_batch_avx512(
+    const key_type *keys,
+    value_type *out,
+    const size_t n) const
+{
+    if (!m_has_root) {
+        std::fill_n(out, n, NO_VALUE);
+        return;
+    }
+
+    find_batch_avx512(tables(), keys, out, n);
+}
+
+/*
+ * As find_batch_avx2(), 16 keys at a time with mask registers
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+template <typename Leaves>
+__attribute__((target("avx512f")))
+void
+basic_lctrie<K, V, O, L, D, I>::find_batch_avx512(
+    const table_view<Leaves> &t,
+    const key_type *keys,
+    value_type *out,
+    const size_t n)
+{
+    constexpr auto BRANCH_BITS = int(layout_type::BRANCH_BITS);
+    constexpr auto NEXT_SHIFT = int(layout_type::BRANCH_BITS + layout_type::SKIP_BITS);
+    constexpr auto OFFSET_MASK = sizeof(offset_type) < 4U ?
+        int((1U << (8U * sizeof(offset_type))) - 1U) : -1;
+
+    const auto nodes = reinterpret_cast<const int *>(t.nodes);
+    const auto key_field = t.leaves->key_field();
+    const auto len_field = t.leaves->len_field();
+    const auto offset_field = t.leaves->offset_field();
+    const auto data_key = reinterpret_cast<const int *>(key_field.base);
+    const auto data_len = reinterpret_cast<const int *>(len_field.base);
+    const auto data_offset = reinterpret_cast<const int *>(offset_field.base);
+
+    // the gathers below read the slots as plain words; x86 loads each one
+    // whole, and in order after the root the way load_node() would
+    const auto root_node = load_node(t.nodes[0]);
+    int root;
+    std::memcpy(&root, &root_node, sizeof(root));
+
+    const auto zero = _mm512_setzero_si512();
+    const auto ones = _mm512_set1_epi32(1);
+    const auto all = _mm512_set1_epi32(-1);
+    const auto branch_mask = _mm512_set1_epi32((1 << BRANCH_BITS) - 1);
+    const auto skip_mask = _mm512_set1_epi32((1 << layout_type::SKIP_BITS) - 1);
+    const auto key_stride = _mm512_set1_epi32(int(key_field.stride));
+    const auto len_stride = _mm512_set1_epi32(int(len_field.stride));
+    const auto offset_stride = _mm512_set1_epi32(int(offset_field.stride));
+    size_t first = 0U;
+
+    for (; first + 16U <= n; first += 16U) {
+        const auto key = _mm512_loadu_si512(keys + first);
+        auto word = _mm512_set1_epi32(root);
+        auto pos = _mm512_set1_epi32(int(KEY_BITS - 1U));
+
+        for (;;) {
+            const auto branch = _mm512_and_si512(word, branch_mask);
+            const auto active = _mm512_test_epi32_mask(branch, branch);
+
+            if (active == 0U) {
+                break;
+            }
+
+            const auto skip = _mm512_and_si512(_mm512_srli_epi32(word, BRANCH_BITS), skip_mask);
+            pos = _mm512_sub_epi32(pos, skip);
+
+            const auto shift = _mm512_add_epi32(_mm512_sub_epi32(pos, branch), ones);
+            const auto mask = _mm512_sub_epi32(_mm512_sllv_epi32(ones, branch), ones);
+            const auto bits = _mm512_and_si512(_mm512_srlv_epi32(key, shift), mask);
+            const auto next = _mm512_add_epi32(_mm512_srli_epi32(word, NEXT_SHIFT), bits);
+
+            word = _mm512_mask_i32gather_epi32(word, active, next, nodes, 4);
+            pos = _mm512_sub_epi32(pos, branch);
+        }
+
+        const auto index = _mm512_srli_epi32(word, NEXT_SHIFT);
+        const auto leaf_key = _mm512_i32gather_epi32(_mm512_mullo_epi32(index, key_stride), data_key, 1);
+        const auto leaf_len = _mm512_and_si512(
+            _mm512_i32gather_epi32(_mm512_mullo_epi32(index, len_stride), data_len, 1), _mm512_set1_epi32(0xFF));
+        const auto prefix = _mm512_sllv_epi32(
+            all, _mm512_sub_epi32(_mm512_set1_epi32(int(KEY_BITS)), leaf_len));
+        const auto diff = _mm512_and_si512(_mm512_xor_si512(key, leaf_key), prefix);
+        const auto hits = _mm512_cmpeq_epi32_mask(diff, zero);
+        const auto offset = _mm512_and_si512(
+            _mm512_i32gather_epi32(_mm512_mullo_epi32(index, offset_stride), data_offset, 1), _mm512_set1_epi32(OFFSET_MASK));
+
+        alignas(64) uint32_t lane_index[16];
+        alignas(64) uint32_t lane_offset[16];
+        _mm512_store_si512(lane_index, index);
+        _mm512_store_si512(lane_offset, offset);
+
+        for (auto i = 0U; i < 16U; ++i) {
+            out[first + i] = (hits >> i) & 1U ?
+                t.vals[lane_offset[i]] : find_leaf(t, lane_index[i], keys[first + i]);
+        }
+    }
+
+    find_batch(t, keys + first, out + first, n - first);
+}
+
+#endif
+
+/*
+ * Sets the options used by the following init() calls
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::set_options(const build_options &options)
+{
+    if (options.root_branch > MAX_BRANCH || options.root_branch >= KEY_BITS) {
+        throw std::invalid_argument("lctrie: root_branch does not fit the branch field");
+    }
+
+    if (!(options.fill_factor > 0.0 && options.fill_factor <= 1.0)) {
+        throw std::invalid_argument("lctrie: fill_factor must be in (0, 1]");
+    }
+
+    if (!(options.max_garbage >= 0.0)) {
+        throw std::invalid_argument("lctrie: max_garbage must not be negative");
+    }
+
+    m_options = options;
+}
+
+/*
+ * Returns the threads a build or sort may use
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+unsigned
+basic_lctrie<K, V, O, L, D, I>::thread_count() const
+{
+    return m_options.threads != 0U ? m_options.threads :
+        std::max(1U, std::thread::hardware_concurrency());
+}
+
+/*
+ * Brings @routes into the form init() expects: the bits of each prefix
+ * below its length cleared, sorted by (prefix, len), and one route per
+ * prefix, picked by the duplicates option. Throws std::invalid_argument
+ * on a length wider than the key.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::ingest(route_input_type &routes) const
+{
+    for (auto &route : routes) {
+        if (route.len > KEY_BITS) {
+            throw std::invalid_argument("lctrie: prefix length exceeds the key width");
+        }
+
+        route.prefix &= prefix_mask(route.len);
+    }
+
+    radix_sort(routes);
+
+    // the sort is stable, so each run of duplicates is in input order
+    const auto last_wins = m_options.duplicates == duplicate_policy::last_wins;
+    auto out = routes.begin();
+
+    for (auto itr = routes.begin(); itr != routes.end();) {
+        auto end = itr + 1;
+
+        while (end != routes.end() && end->prefix == itr->prefix && end->len == itr->len) {
+            ++end;
+        }
+
+        *out++ = last_wins ? *(end - 1) : *itr;
+        itr = end;
+    }
+
+    routes.erase(out, routes.end());
+}
+
+/*
+ * Sorts @routes by (prefix, len) with a stable LSD radix sort, one byte
+ * per pass: len first, then the prefix from its least significant byte.
+ * Each thread counts and scatters its own chunk, and the chunks' offsets
+ * into each bucket follow chunk order, which keeps the sort stable. A pass
+ * whose byte is the same for every route is skipped, and input that is
+ * already sorted, as table dumps usually are, is only checked.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::radix_sort(route_input_type &routes) const
+{
+    constexpr auto RADIX = 256U;
+
+    const auto less = [](const route_type &a, const route_type &b) {
+        return a.prefix < b.prefix || (a.prefix == b.prefix && a.len < b.len);
+    };
+
+    if (std::is_sorted(routes.begin(), routes.end(), less)) {
+        return;
+    }
+
+    const auto n = routes.size();
+    const auto threads = n < SORT_GRAIN ? 1U :
+        unsigned(std::min(size_t(thread_count()), n / (SORT_GRAIN / 2U)));
+    const auto chunk = (n + threads - 1U) / threads;
+
+    std::vector<size_t> counts(size_t(threads) * RADIX);
+    route_input_type scratch(n);
+    auto *from = routes.data();
+    auto *to = scratch.data();
+
+    const auto pass = [&](const auto digit) {
+        std::fill(counts.begin(), counts.end(), size_t(0U));
+
+        run_threads(threads, [&](const unsigned t) {
+            const auto last = std::min(n, (t + 1U) * chunk);
+            auto *count = &counts[t * RADIX];
+
+            for (auto i = std::min(n, t * chunk); i < last; ++i) {
+                count[digit(from[i])]++;
+            }
+        });
+
+        // turn the counts into each chunk's first index in each bucket
+        auto offset = size_t(0U);
+
+        for (auto d = 0U; d < RADIX; ++d) {
+            const auto start = offset;
+
+            for (auto t = 0U; t < threads; ++t) {
+                const auto count = counts[t * RADIX + d];
+
+                counts[t * RADIX + d] = offset;
+                offset += count;
+            }
+
+            if (offset - start == n) {
+                return;
+            }
+        }
+
+        run_threads(threads, [&](const unsigned t) {
+            const auto last = std::min(n, (t + 1U) * chunk);
+            auto *bucket = &counts[t * RADIX];
+
+            for (auto i = std::min(n, t * chunk); i < last; ++i) {
+                to[bucket[digit(from[i])]++] = from[i];
+            }
+        });
+
+        std::swap(from, to);
+    };
+
+    pass([](const route_type &route) { return unsigned(route.len); });
+
+    for (auto shift = 0U; shift < KEY_BITS; shift += 8U) {
+        pass([shift](const route_type &route) { return unsigned(uint8_t(route.prefix >> shift)); });
+    }
+
+    if (from != routes.data()) {
+        routes.swap(scratch);
+    }
+}
+
+/*
+ * Takes the keys in any order; every key is stored as a full-length route,
+ * and of keys given more than once the duplicates option picks the value
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::init(const input_type &input)
+{
+    route_input_type routes;
+    routes.reserve(input.size());
+
+    for (const auto &in : input) {
+        routes.push_back({ in.first, uint8_t(KEY_BITS), in.second });
+    }
+
+    ingest(routes);
+    init(routes);
+}
+
+/*
+ * expects routes sorted by (prefix, len), without duplicates, as ingest()
+ * leaves them; throws std::invalid_argument otherwise
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::init(const route_input_type &routes)
+{
+    init_map(routes, nullptr);
+    init_trie();
+}
+
+/*
+ * As above, with m_vals seeded from the pre-interned @values
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::init(const route_input_type &routes, const value_input_type &values)
+{
+    init_map(routes, &values);
+    init_trie();
+}
+
+/*
+ * Builds the nodes, leaves and prefixes of @routes with the value offsets
+ * of @offsets, leaving m_vals empty: the trie only serves as a part of a
+ * table whose pool is kept elsewhere, as multi_lctrie keeps it, and cannot
+ * be looked up on its own
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::init_shared(const route_input_type &routes, const value_map_type &offsets)
+{
+    init_map(routes, nullptr, &offsets);
+    init_trie();
+}
+
+/*
+ * Adds the route @prefix/@len, or replaces its value if it is stored
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::insert(const key_type prefix, const uint8_t len, const value_type value)
+{
+    if (len > KEY_BITS) {
+        throw std::invalid_argument("lctrie: prefix length exceeds the key width");
+    }
+
+    if (!m_data) {
+        init(route_input_type());
+    }
+
+    update({ key_type(prefix & prefix_mask(len)), len, intern(value, m_value_map) }, false, false);
+}
+
+/*
+ * Removes the route @prefix/@len; returns false if it is not stored
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+bool
+basic_lctrie<K, V, O, L, D, I>::erase(const key_type prefix, const uint8_t len)
+{
+    if (len > KEY_BITS || !m_data) {
+        return false;
+    }
+
+    return update({ key_type(prefix & prefix_mask(len)), len, 0U }, true, false) ==
+        update_status::applied;
+}
+
+/*
+ * As insert(), but safe while other threads run lookups: the new subtrie is
+ * built in spare capacity and nothing a lookup can reach is written before
+ * the slot is published. Returns no_room, and changes nothing a lookup can
+ * see, when the update needs more capacity than reserve_headroom() left, a
+ * rebuild from the root or a recompaction.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::try_insert(const key_type prefix, const uint8_t len, const value_type value)
+    -> update_status
+{
+    if (len > KEY_BITS) {
+        throw std::invalid_argument("lctrie: prefix length exceeds the key width");
+    }
+
+    if (!m_data || (m_value_map.count(value) == 0U && m_vals->size() == m_vals->capacity())) {
+        return update_status::no_room;
+    }
+
+    return update({ key_type(prefix & prefix_mask(len)), len, intern(value, m_value_map) }, false, true);
+}
+
+/*
+ * As erase(), with the guarantees of try_insert()
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::try_erase(const key_type prefix, const uint8_t len) -> update_status
+{
+    if (len > KEY_BITS || !m_data) {
+        return update_status::not_found;
+    }
+
+    return update({ key_type(prefix & prefix_mask(len)), len, 0U }, true, true);
+}
+
+/*
+ * Applies a batch of changes, such as a full-table refresh: @withdraws
+ * first, then @adds, so a prefix named in both ends up added. The adds are
+ * taken as init() takes routes, duplicates option included. A stored
+ * route announced again with the value it has, or a withdraw of a route
+ * not stored, is dropped. Every other change picks the slot insert() or
+ * erase() would rebuild for it, and slots nested in another one's fold
+ * into it. The rest hold disjoint key ranges; each is collected and merged
+ * with its changes on a worker, its routes are appended to m_data, and its
+ * subtrie is built at the end of m_nodes, on workers as well once the
+ * batch is large.
+ *
+ * The blocks between those slots and the deepest slot above all of them
+ * are copied to the end of m_nodes too, each copy pointing at the copies
+ * or new subtries below it, and m_nodes, m_data and m_prefixes are
+ * reserved for all of it up front. Nothing a lookup can reach changes
+ * until that one slot is stored, pointing at the copy of its block, so a
+ * lookup sees none of the batch or all of it. Everything outside the
+ * copied blocks and rebuilt slots stays where it is. A batch that reaches
+ * the root, or would push the garbage past max_garbage, rebuilds the whole
+ * trie from its routes instead.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::apply_batch(const route_input_type &adds, const prefix_input_type &withdraws)
+    -> batch_result
+{
+    batch_result result = { 0U, 0U, 0U, 0U };
+
+    update_batch(adds, withdraws, false, result);
+    return result;
+}
+
+/*
+ * As apply_batch(), but safe while other threads run lookups, as
+ * try_insert() is. Returns no_room, and changes nothing a lookup can see,
+ * when the batch needs more capacity than reserve_headroom() left, a
+ * rebuild from the root or a recompaction; @result is then undefined.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::try_apply_batch(const route_input_type &adds, const prefix_input_type &withdraws,
+                                                batch_result &result) -> update_status
+{
+    result = { 0U, 0U, 0U, 0U };
+    return update_batch(adds, withdraws, true, result);
+}
+
+/*
+ * Does the work of apply_batch() and, with @in_place, of try_apply_batch()
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::update_batch(const route_input_type &adds, const prefix_input_type &withdraws,
+                                             const bool in_place, batch_result &result) -> update_status
+{
+    if (!m_data) {
+        if (in_place) {
+            return update_status::no_room;
+        }
+
+        init(route_input_type());
+    }
+
+    // the adds as init() takes routes, the withdraws sorted the same way
+    auto announced = adds;
+    mapped_input_type removed;
+
+    ingest(announced);
+    removed.reserve(withdraws.size());
+
+    for (const auto &withdraw : withdraws) {
+        if (withdraw.second > KEY_BITS) {
+            throw std::invalid_argument("lctrie: prefix length exceeds the key width");
+        }
+
+        removed.push_back({ key_type(withdraw.first & prefix_mask(withdraw.second)), withdraw.second, 0U });
+    }
+
+    std::sort(removed.begin(), removed.end(), route_less);
+    removed.erase(std::unique(removed.begin(), removed.end(), route_equal), removed.end());
+
+    // interning a new value appends it to m_vals, which must not reallocate
+    if (in_place) {
+        value_map_type fresh;
+
+        for (const auto &add : announced) {
+            if (m_value_map.count(add.value) == 0U) {
+                fresh.emplace(add.value, 0U);
+            }
+        }
+
+        if (m_vals->size() + fresh.size() > m_vals->capacity()) {
+            return update_status::no_room;
+        }
+    }
+
+    // one change per route, an add over a withdraw of the same route
+    std::vector<batch_change> changes;
+    auto gone = removed.cbegin();
+
+    changes.reserve(announced.size() + removed.size());
+
+    for (const auto &add : announced) {
+        const auto route = mapped_route{ add.prefix, add.len, 0U };
+
+        for (; gone != removed.cend() && route_less(*gone, route); ++gone) {
+            changes.push_back({ *gone, true, 0U, {} });
+        }
+
+        if (gone != removed.cend() && route_equal(*gone, route)) {
+            ++gone;
+        }
+
+        changes.push_back({ { add.prefix, add.len, intern(add.value, m_value_map) }, false, 0U, {} });
+    }
+
+    for (; gone != removed.cend(); ++gone) {
+        changes.push_back({ *gone, true, 0U, {} });
+    }
+
+    // most of a full-table refresh announces routes again with the value
+    // they have, and withdraws of routes not stored do nothing either
+    if (!m_nodes->empty()) {
+        auto out = changes.begin();
+
+        for (const auto &change : changes) {
+            const auto at = locate(change.route);
+
+            if (at.found && !change.erase) {
+                const auto old = at.leaf ? m_data->offset(at.index) : (*m_prefixes)[at.index].offset;
+
+                if (old != change.route.offset) {
+                    *out++ = change;
+                    result.updated++;
+                }
+            } else if (at.found || !change.erase) {
+                *out++ = change;
+            }
+        }
+
+        changes.erase(out, changes.end());
+    }
+
+    if (changes.empty()) {
+        return update_status::applied;
+    }
+
+    // the fallback, which a lookup cannot run alongside
+    const auto rebuild_whole = [this, in_place, &changes, &result]() {
+        if (in_place) {
+            return update_status::no_room;
+        }
+
+        rebuild_all(changes, result);
+        return update_status::applied;
+    };
+
+    if (m_nodes->empty()) {
+        return rebuild_whole();
+    }
+
+    update_slot path[KEY_BITS + 1U];
+
+    for (auto &change : changes) {
+        change.index = update_path(change.route, path);
+        change.slot = path[change.index];
+    }
+
+    const auto fixed = [](const batch_change &change) {
+        return key_type(change.route.prefix & prefix_mask(uint8_t(change.slot.depth)));
+    };
+
+    // whether the slot of @outer holds the keys of the slot of @inner
+    const auto contains = [&fixed](const batch_change &outer, const batch_change &inner) {
+        return outer.slot.depth <= inner.slot.depth &&
+            key_type(inner.route.prefix & prefix_mask(uint8_t(outer.slot.depth))) == fixed(outer);
+    };
+
+    const auto threads = thread_count();
+    std::vector<batch_group> groups;
+
+    for (;;) {
+        // the slots in key order, each ahead of those nested in it, so the
+        // outermost ones are those no earlier outermost one contains
+        std::vector<const batch_change *> slots;
+        std::vector<const batch_change *> outers;
+
+        slots.reserve(changes.size());
+
+        for (const auto &change : changes) {
+            slots.push_back(&change);
+        }
+
+        std::sort(slots.begin(), slots.end(), [&fixed](const batch_change *a, const batch_change *b) {
+            return fixed(*a) < fixed(*b) || (fixed(*a) == fixed(*b) && a->slot.depth < b->slot.depth);
+        });
+
+        for (const auto slot : slots) {
+            if (outers.empty() || !contains(*outers.back(), *slot)) {
+                outers.push_back(slot);
+            }
+        }
+
+        if (outers.front()->index == 0U) {
+            return rebuild_whole();
+        }
+
+        // both are in key order, and the changes of one slot are adjacent
+        std::vector<batch_group> next;
+
+        for (auto i = size_t(0U), g = size_t(0U); i < changes.size(); ++i) {
+            while (!contains(*outers[g], changes[i])) {
+                ++g;
+            }
+
+            if (next.empty() || next.back().slot.pos != outers[g]->slot.pos) {
+                next.push_back({ outers[g]->slot, outers[g]->index, i, i, 0U, false, {} });
+            }
+
+            next.back().last = i + 1U;
+        }
+
+        // a group of the same changes as in the last round keeps what it
+        // collected then
+        std::vector<size_t> pending;
+        auto old = groups.begin();
+
+        for (auto i = size_t(0U); i < next.size(); ++i) {
+            auto &group = next[i];
+
+            while (old != groups.end() && old->first < group.first) {
+                ++old;
+            }
+
+            if (old != groups.end() && old->first == group.first && old->last == group.last &&
+                old->slot.pos == group.slot.pos) {
+                group.withdrawn = old->withdrawn;
+                group.collected = true;
+                group.state = std::move(old->state);
+            } else {
+                pending.push_back(i);
+            }
+        }
+
+        groups = std::move(next);
+
+        std::vector<std::exception_ptr> errors(pending.size());
+        std::atomic<size_t> cursor{ 0U };
+
+        run_threads(unsigned(std::min(size_t(threads), pending.size())), [&](unsigned) {
+            for (auto i = cursor.fetch_add(1U); i < pending.size(); i = cursor.fetch_add(1U)) {
+                auto &group = groups[pending[i]];
+
+                try {
+                    const auto key = changes[group.first].route.prefix;
+
+                    group.state = { {}, NO_PREFIX, false, 0U, 0U, {} };
+                    collect(group.slot.pos, group.slot.depth, group.slot.depth,
+                            key_type(key & prefix_mask(uint8_t(group.slot.depth))), 0U, 0U, 0U, group.state);
+
+                    auto &routes = group.state.routes;
+                    std::sort(routes.begin(), routes.end(), route_less);
+                    routes.erase(std::unique(routes.begin(), routes.end(), route_equal), routes.end());
+                    group.withdrawn = merge_changes(routes, changes.data() + group.first,
+                                                    changes.data() + group.last);
+                    group.collected = true;
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }
+        });
+
+        for (const auto &error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        // as with erase(), a slot left with nothing has its parent rebuilt
+        auto lifted = false;
+
+        for (const auto &group : groups) {
+            if (!group.state.routes.empty()) {
+                continue;
+            }
+
+            for (auto i = group.first; i < group.last; ++i) {
+                update_path(changes[i].route, path);
+                changes[i].index = group.index - 1U;
+                changes[i].slot = path[changes[i].index];
+            }
+
+            lifted = true;
+        }
+
+        if (!lifted) {
+            break;
+        }
+    }
+
+    result.subtries = groups.size();
+
+    // the deepest slot on the walks down to every group, at @top below the
+    // root; a lone group is its own
+    update_slot shared[KEY_BITS + 1U];
+    auto top = groups.front().index;
+
+    update_path(changes[groups.front().first].route, shared);
+
+    for (const auto &group : groups) {
+        update_path(changes[group.first].route, path);
+
+        auto j = size_t(0U);
+
+        while (j < std::min(top, group.index) && path[j + 1U].pos == shared[j + 1U].pos) {
+            ++j;
+        }
+
+        top = j;
+    }
+
+    // the blocks between that slot and the groups, by where they are, each
+    // copied once however many groups lie below it; 0 until copied
+    std::unordered_map<size_t, size_t> copies;
+    auto copied = size_t(0U);
+
+    for (const auto &group : groups) {
+        update_path(changes[group.first].route, path);
+
+        for (auto j = top; j < group.index; ++j) {
+            const auto node = (*m_nodes)[path[j].pos];
+
+            if (copies.emplace(size_t(node.next), 0U).second) {
+                copied += size_t(1U) << node.branch;
+            }
+        }
+    }
+
+    auto dead_nodes = m_dead_nodes + copied;
+    auto dead_leaves = m_dead_leaves;
+
+    for (const auto &group : groups) {
+        result.withdrawn += group.withdrawn;
+        result.routes += group.state.routes.size();
+        dead_nodes += group.state.nodes;
+        dead_leaves += group.state.leaves;
+    }
+
+    // the new subtries take about the room the old ones leave
+    const auto nodes = m_nodes->size() + (dead_nodes - m_dead_nodes);
+    const auto leaves = m_data->size() + result.routes;
+
+    if (double(dead_nodes) > m_options.max_garbage * double(nodes) ||
+        double(dead_leaves) > m_options.max_garbage * double(leaves)) {
+        return rebuild_whole();
+    }
+
+    // room for the copies, each padded to a cache line when aligning
+    // children, and for the subtries, one extra root each when built on
+    // workers
+    constexpr auto line = std::max(size_t(1U), cache_allocator<node_type>::ALIGN / sizeof(node_type));
+    const auto node_room = m_nodes->size() + copied + (m_options.align_children ? copies.size() * line : 0U) +
+        max_nodes(result.routes) + groups.size();
+    const auto prefix_room = m_prefixes->size() + result.routes;
+
+    if (in_place) {
+        if (node_room > m_nodes->capacity() || node_room > MAX_NEXT + 1U || leaves > m_data->capacity() ||
+            leaves > MAX_NEXT + 1U || prefix_room > m_prefixes->capacity() || prefix_room >= NO_PREFIX) {
+            return update_status::no_room;
+        }
+    } else {
+        m_nodes->reserve(node_room);
+        m_data->reserve(leaves);
+        m_prefixes->reserve(prefix_room);
+    }
+
+    // copy the blocks top down, pointing each copy of a slot on the walk at
+    // the copy of its block, and move each group to the copy of its slot
+    auto root = (*m_nodes)[shared[top].pos];
+
+    for (auto &group : groups) {
+        update_path(changes[group.first].route, path);
+
+        auto slot = group.slot.pos;
+
+        for (auto j = top; j < group.index; ++j) {
+            const auto node = (*m_nodes)[path[j].pos];
+            const auto block = size_t(node.next);
+            auto &copy = copies[block];
+
+            if (copy == 0U) {
+                const auto size = size_t(1U) << node.branch;
+
+                copy = align_block(m_nodes->size(), node.branch);
+                m_nodes->resize(copy + size);
+                std::copy_n(m_nodes->begin() + std::ptrdiff_t(block), size,
+                            m_nodes->begin() + std::ptrdiff_t(copy));
+                (j == top ? root : (*m_nodes)[slot]).next = node_storage(copy);
+            }
+
+            slot = copy + (path[j + 1U].pos - block);
+        }
+
+        group.slot.pos = slot;
+    }
+
+    std::vector<build_task> tasks;
+
+    tasks.reserve(groups.size());
+
+    for (const auto &group : groups) {
+        const auto first = m_data->size();
+
+        add_routes(group.state.routes, group.state.outer);
+        tasks.push_back({ first, m_data->size() - first, group.slot.depth, group.slot.pos });
+    }
+
+    if (threads == 1U || result.routes < 2U * BUILD_GRAIN) {
+        // the blocks of each subtrie are appended one by one
+        for (const auto &task : tasks) {
+            make_node(*m_nodes, task.first, task.nkeys, task.pre, task.pos, 0U, nullptr);
+        }
+    } else {
+        build_parallel(tasks, threads);
+    }
+
+    // everything above is out of reach until the top slot points at it; a
+    // lone group's slot was stored as its subtrie was built
+    m_dead_nodes = dead_nodes;
+    m_dead_leaves = dead_leaves;
+
+    if (!copies.empty()) {
+        publish_node(*m_nodes, shared[top].pos, root);
+    }
+
+    advance_generation();
+    return update_status::applied;
+}
+
+/*
+ * Applies the sorted changes [@first, @last) to the sorted @routes and
+ * returns how many of the withdraws among them found their route
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+size_t
+basic_lctrie<K, V, O, L, D, I>::merge_changes(mapped_input_type &routes, const batch_change *first,
+                                              const batch_change *last)
+{
+    mapped_input_type merged;
+    auto withdrawn = size_t(0U);
+    auto itr = routes.cbegin();
+
+    merged.reserve(routes.size() + size_t(last - first));
+
+    for (auto change = first; change != last; ++change) {
+        while (itr != routes.cend() && route_less(*itr, change->route)) {
+            merged.push_back(*itr++);
+        }
+
+        const auto found = itr != routes.cend() && route_equal(*itr, change->route);
+
+        if (found) {
+            ++itr;
+        }
+
+        if (!change->erase) {
+            merged.push_back(change->route);
+        } else if (found) {
+            ++withdrawn;
+        }
+    }
+
+    merged.insert(merged.end(), itr, routes.cend());
+    routes = std::move(merged);
+    return withdrawn;
+}
+
+/*
+ * The fallback of apply_batch(): rebuilds the trie from its routes with
+ * @changes applied, and adds to @result
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::rebuild_all(const std::vector<batch_change> &changes, batch_result &result)
+{
+    collect_state state = { {}, NO_PREFIX, false, 0U, 0U, {} };
+
+    if (!m_nodes->empty()) {
+        collect(0U, 0U, 0U, 0U, 0U, 0U, 0U, state);
+        std::sort(state.routes.begin(), state.routes.end(), route_less);
+        state.routes.erase(std::unique(state.routes.begin(), state.routes.end(), route_equal),
+                           state.routes.end());
+    }
+
+    result.withdrawn = merge_changes(state.routes, changes.data(), changes.data() + changes.size());
+    result.subtries = 0U;
+    result.routes = state.routes.size();
+    rebuild(state.routes);
+}
+
+/*
+ * Returns a recompacted copy of the trie that shares no storage with it
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::clone() const -> std::unique_ptr<basic_lctrie>
+{
+    auto copy = std::make_unique<basic_lctrie>();
+
+    copy->m_options = m_options;
+    copy->m_value_map = m_value_map;
+    copy->m_vals = std::make_unique<cache_vector<value_type>>(*m_vals);
+
+    collect_state state = { {}, NO_PREFIX, false, 0U, 0U, {} };
+
+    if (m_nodes && !m_nodes->empty()) {
+        collect(0U, 0U, 0U, 0U, 0U, 0U, 0U, state);
+        std::sort(state.routes.begin(), state.routes.end(), route_less);
+        state.routes.erase(std::unique(state.routes.begin(), state.routes.end(), route_equal),
+                           state.routes.end());
+    }
+
+    copy->rebuild(state.routes);
+    return copy;
+}
+
+/*
+ * Returns an exact copy of the trie, garbage and room to grow included, in
+ * an arena on @numa_node. Unlike a clone, the copy has the same layout and
+ * capacities, so try_insert() and try_erase() do the same on both.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::replicate(const int numa_node) const -> std::unique_ptr<basic_lctrie>
+{
+    auto copy = std::make_unique<basic_lctrie>();
+
+    copy->m_options = m_options;
+    copy->m_options.numa_node = numa_node;
+    copy->m_value_map = m_value_map;
+    copy->m_dead_nodes = m_dead_nodes;
+    copy->m_dead_leaves = m_dead_leaves;
+    copy->m_generation.store(generation(), std::memory_order_relaxed);
+
+    if (m_nodes) {
+        copy->copy_to_arena(*this, m_nodes->capacity(), m_data->capacity(), m_prefixes->capacity(),
+                            m_vals->capacity());
+    }
+
+    return copy;
+}
+
+/*
+ * Reserves room for each array to grow by @fraction of its size, so that
+ * many try_insert(), try_erase() and try_apply_batch() calls can be made
+ * in place
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::reserve_headroom(const double fraction)
+{
+    if (!m_nodes) {
+        return;
+    }
+
+    if (m_options.arena || m_options.huge_pages || m_options.numa_node >= 0) {
+        move_to_arena(fraction);
+        return;
+    }
+
+    const auto grow = [fraction](const size_t n) {
+        return n + size_t(double(n) * fraction) + 64U;
+    };
+
+    m_nodes->reserve(grow(m_nodes->size()));
+    m_data->reserve(grow(m_data->size()));
+    m_prefixes->reserve(grow(m_prefixes->size()));
+    m_vals->reserve(grow(m_vals->size()));
+}
+
+/*
+ * Rebuilds the whole trie from the routes it holds, dropping everything
+ * local rebuilds left unreachable
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::recompact()
+{
+    if (!m_nodes || m_nodes->empty()) {
+        return;
+    }
+
+    collect_state state = { {}, NO_PREFIX, false, 0U, 0U, {} };
+    collect(0U, 0U, 0U, 0U, 0U, 0U, 0U, state);
+    std::sort(state.routes.begin(), state.routes.end(), route_less);
+    state.routes.erase(std::unique(state.routes.begin(), state.routes.end(), route_equal),
+                       state.routes.end());
+    rebuild(state.routes);
+}
+
+/*
+ * Returns the child blocks of the trie in breadth-first order, the root's
+ * first, and fills @at with the block starting at each node of m_nodes.
+ * The children of a block are pushed together while it is visited, so
+ * they take one range of the result.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::node_blocks(std::vector<size_t> &at) const -> std::vector<node_block>
+{
+    const auto &nodes = *m_nodes;
+    std::vector<node_block> blocks;
+
+    at.assign(nodes.size(), ~size_t(0));
+
+    if (nodes[0].branch == 0U) {
+        return blocks;
+    }
+
+    blocks.push_back({ nodes[0].next, nodes[0].branch, 0U, 0U });
+    at[nodes[0].next] = 0U;
+
+    for (auto b = size_t(0U); b < blocks.size(); ++b) {
+        blocks[b].children = blocks.size();
+
+        for (auto i = size_t(0U); i < (size_t(1U) << blocks[b].branch); ++i) {
+            const auto node = nodes[blocks[b].next + i];
+
+            if (node.branch != 0U) {
+                at[node.next] = blocks.size();
+                blocks.push_back({ node.next, node.branch, 0U, 0U });
+            }
+        }
+
+        blocks[b].end = blocks.size();
+    }
+
+    return blocks;
+}
+
+/*
+ * Appends the blocks of the subtrie under @b, cut to its top @height
+ * levels, in van Emde Boas order: the top half of the levels, then each
+ * subtrie hanging off it, every part laid out the same way
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::veb_order(
+    const std::vector<node_block> &blocks,
+    const size_t b,
+    const size_t height,
+    std::vector<size_t> &order)
+{
+    if (height == 1U) {
+        order.push_back(b);
+        return;
+    }
+
+    const auto top = height / 2U;
+    std::vector<size_t> frontier = { b };
+
+    veb_order(blocks, b, top, order);
+
+    for (auto level = size_t(0U); level < top; ++level) {
+        std::vector<size_t> below;
+
+        for (const auto f : frontier) {
+            for (auto c = blocks[f].children; c < blocks[f].end; ++c) {
+                below.push_back(c);
+            }
+        }
+
+        frontier.swap(below);
+    }
+
+    for (const auto f : frontier) {
+        veb_order(blocks, f, height - top, order);
+    }
+}
+
+/*
+ * Copies the blocks into a new m_nodes in @order and points every internal
+ * node at the new place of its block. Nodes no lookup reaches, padding
+ * and the garbage of insert() and erase(), are left behind; the capacity
+ * is kept so reserve_headroom() still holds.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::place_blocks(
+    const std::vector<node_block> &blocks,
+    const std::vector<size_t> &at,
+    const std::vector<size_t> &order)
+{
+    const auto &old = *m_nodes;
+    std::vector<size_t> start(blocks.size());
+    auto size = size_t(1U);
+
+    for (const auto b : order) {
+        start[b] = align_block(size, blocks[b].branch);
+        size = start[b] + (size_t(1U) << blocks[b].branch);
+    }
+
+    if (size - 1U > MAX_NEXT) {
+        throw std::length_error("lctrie: too many nodes for the next field");
+    }
+
+    auto nodes = std::make_unique<cache_vector<node_type>>();
+    nodes->reserve(std::max(size, old.capacity()));
+    nodes->resize(size);
+
+    const auto moved = [&](node_type node) {
+        if (node.branch != 0U) {
+            node.next = node_storage(start[at[node.next]]);
+        }
+
+        return node;
+    };
+
+    (*nodes)[0] = moved(old[0]);
+
+    for (auto b = size_t(0U); b < blocks.size(); ++b) {
+        for (auto i = size_t(0U); i < (size_t(1U) << blocks[b].branch); ++i) {
+            (*nodes)[start[b] + i] = moved(old[blocks[b].next + i]);
+        }
+    }
+
+    m_nodes = std::move(nodes);
+    m_has_root = true;
+    m_dead_nodes = 0U;
+
+    if (m_options.arena || m_options.huge_pages || m_options.numa_node >= 0) {
+        move_to_arena(0.0);
+    }
+}
+
+/*
+ * Reorders the child blocks of m_nodes. make_node() lays a subtrie out
+ * depth first, so the blocks of one level are spread across the array;
+ * breadth first keeps the top levels, which every lookup reads, in a few
+ * lines and pages, and van Emde Boas order keeps each part of a path
+ * together at every scale. Depth first restores the order of a fresh
+ * build. Blocks are only ever moved whole, since a lookup indexes into
+ * them. Not safe under concurrent lookups.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::relayout(const node_order order)
+{
+    if (!m_nodes || m_nodes->empty()) {
+        return;
+    }
+
+    std::vector<size_t> at;
+    const auto blocks = node_blocks(at);
+    std::vector<size_t> placed;
+
+    placed.reserve(blocks.size());
+
+    if (order == node_order::depth_first) {
+        // preorder, children in slot order, as make_node() allocates them
+        std::vector<size_t> pending;
+
+        if (!blocks.empty()) {
+            pending.push_back(0U);
+        }
+
+        while (!pending.empty()) {
+            const auto b = pending.back();
+
+            pending.pop_back();
+            placed.push_back(b);
+
+            for (auto c = blocks[b].end; c-- > blocks[b].children;) {
+                pending.push_back(c);
+            }
+        }
+    } else if (order == node_order::breadth_first) {
+        for (auto b = size_t(0U); b < blocks.size(); ++b) {
+            placed.push_back(b);
+        }
+    } else if (!blocks.empty()) {
+        std::vector<size_t> height(blocks.size(), 1U);
+
+        for (auto b = blocks.size(); b-- > 0U;) {
+            for (auto c = blocks[b].children; c < blocks[b].end; ++c) {
+                height[b] = std::max(height[b], height[c] + 1U);
+            }
+        }
+
+        veb_order(blocks, 0U, height[0], placed);
+    }
+
+    place_blocks(blocks, at, placed);
+}
+
+/*
+ * Reorders the child blocks of m_nodes hottest first, by how often the
+ * walks for the @n sampled @keys read them. A block is read at most as
+ * often as the block above it, so the paths most lookups take end up
+ * packed at the front of the array; blocks read equally often stay in
+ * breadth-first order.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::relayout(const key_type *keys, const size_t n)
+{
+    if (!m_nodes || m_nodes->empty()) {
+        return;
+    }
+
+    relayout_hot(keys, nullptr, n);
+}
+
+/*
+ * As above, from a count of the lookups that ended on each leaf of m_data,
+ * such as a cache in front of lookup_leaf() keeps
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::relayout(const std::vector<uint64_t> &leaf_hits)
+{
+    if (!m_nodes || m_nodes->empty()) {
+        return;
+    }
+
+    if (leaf_hits.size() != m_data->size()) {
+        throw std::invalid_argument("lctrie: leaf_hits must count every leaf");
+    }
+
+    std::vector<key_type> keys(m_data->size());
+
+    for (auto i = size_t(0U); i < keys.size(); ++i) {
+        keys[i] = m_data->key(i);
+    }
+
+    relayout_hot(keys.data(), leaf_hits.data(), keys.size());
+}
+
+/*
+ * Walks each of the @n @keys, adding its count in @hits, or 1 without
+ * @hits, to every block the walk reads, and places the blocks by falling
+ * heat
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::relayout_hot(const key_type *keys, const uint64_t *hits, const size_t n)
+{
+    std::vector<size_t> at;
+    const auto blocks = node_blocks(at);
+    const auto &nodes = *m_nodes;
+    std::vector<uint64_t> heat(blocks.size());
+
+    for (auto i = size_t(0U); i < n; ++i) {
+        const auto count = hits != nullptr ? hits[i] : uint64_t(1U);
+        auto node = nodes[0];
+        auto pos = KEY_BITS - 1U;
+
+        while (node.branch != 0U && count != 0U) {
+            pos -= node.skip;
+            heat[at[node.next]] += count;
+            const auto next = node.next + extract(uint8_t(pos), node.branch, keys[i]);
+            pos -= node.branch;
+            node = nodes[next];
+        }
+    }
+
+    std::vector<size_t> placed(blocks.size());
+
+    for (auto b = size_t(0U); b < blocks.size(); ++b) {
+        placed[b] = b;
+    }
+
+    std::stable_sort(placed.begin(), placed.end(), [&](const size_t a, const size_t b) {
+        return heat[a] > heat[b];
+    });
+
+    place_blocks(blocks, at, placed);
+}
+
+/*
+ * Replaces the contents of the trie with the sorted, interned @routes
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::rebuild(const mapped_input_type &routes)
+{
+    m_data = std::make_unique<data_array>();
+    m_prefixes = std::make_unique<cache_vector<prefix_type>>();
+    m_dead_nodes = 0U;
+    m_dead_leaves = 0U;
+
+    reserve_routes(routes);
+    add_routes(routes, NO_PREFIX);
+    init_trie();
+}
+
+/*
+ * Gathers into @state the routes stored under the slot @pos, which sits
+ * @pre bits deep and holds the keys starting with the @depth leading bits
+ * of @fixed. The slot was reached through the @branch bits at @bitpos
+ * having the value @index (branch = 0 for the slot the walk starts from).
+ *
+ * A leaf only counts if it belongs to the slot it is found in: an empty slot
+ * points at a neighbour, and after local rebuilds possibly at a leaf that
+ * has since been replaced, and neither is stored there. Every leaf helps
+ * find the longest prefix outside the slot that covers it, which the
+ * rebuilt chains have to end at.
+ *
+ * Leaves under one prefix share the tail of their chains, so a leaf's walk
+ * stops at the first entry the last leaf of the slot emitted: the rest of
+ * the chain, and the outer prefix it ends at, are the same.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::collect(
+    const size_t pos,
+    const size_t pre,
+    const size_t depth,
+    const key_type fixed,
+    const size_t bitpos,
+    const size_t branch,
+    const size_t index,
+    collect_state &state) const
+{
+    const auto node = (*m_nodes)[pos];
+
+    if (node.branch != 0U) {
+        const auto shared = pre + node.skip;
+
+        state.nodes += size_t(1U) << node.branch;
+
+        for (auto i = 0U; i < (1U << node.branch); ++i) {
+            collect(node.next + i, shared + node.branch, depth, fixed,
+                    KEY_BITS - 1U - shared, node.branch, i, state);
+        }
+
+        return;
+    }
+
+    const auto leaf = size_t(node.next);
+    const auto key = m_data->key(leaf);
+    const auto common = high_zero_count(key_type(key ^ fixed));
+    const auto own = common >= depth &&
+        (branch == 0U || extract(uint8_t(bitpos), uint8_t(branch), key) == index);
+
+    if (own) {
+        state.leaves++;
+        state.routes.push_back({ key, m_data->len(leaf), m_data->offset(leaf) });
+    } else if (state.outer_own) {
+        return;
+    }
+
+    auto &chain = state.chain;
+    auto fresh = size_t(0U);
+
+    for (auto p = m_data->pre(leaf); p != NO_PREFIX; p = (*m_prefixes)[p].pre) {
+        const auto &prefix = (*m_prefixes)[p];
+
+        if (prefix.len >= depth) {
+            if (own) {
+                const auto seen = std::find(chain.begin() + std::ptrdiff_t(fresh), chain.end(), p);
+
+                if (seen != chain.end()) {
+                    chain.erase(chain.begin() + std::ptrdiff_t(fresh), seen);
+                    return;
+                }
+
+                chain.insert(chain.begin() + std::ptrdiff_t(fresh++), p);
+                state.routes.push_back({
+                    key_type(key & prefix_mask(prefix.len)), prefix.len, prefix.offset
+                });
+            }
+        } else if (own || prefix.len <= common) {
+            if (own) {
+                chain.resize(fresh);
+            }
+
+            state.outer = p;
+            state.outer_own = own;
+            return;
+        }
+    }
+
+    if (own) {
+        chain.resize(fresh);
+        state.outer = NO_PREFIX;
+        state.outer_own = true;
+    }
+}
+
+/*
+ * Finds where @route is stored. The walk for the route's own prefix ends
+ * on its leaf, or on a leaf under it whose chain holds it, if it is stored
+ * at all: the lookup of that key could not find the route otherwise.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::locate(const mapped_route &route) const -> route_location
+{
+    auto node = (*m_nodes)[0];
+    auto depth = size_t(0U);
+
+    while (node.branch != 0U) {
+        const auto shared = depth + node.skip;
+        const auto pos = node.next + extract(uint8_t(KEY_BITS - 1U - shared), node.branch, route.prefix);
+
+        depth = shared + node.branch;
+        node = (*m_nodes)[pos];
+    }
+
+    const auto leaf = size_t(node.next);
+    const auto key = m_data->key(leaf);
+
+    if (key_type((key ^ route.prefix) & prefix_mask(route.len)) != 0U) {
+        return { false, false, 0U };
+    }
+
+    if (key == route.prefix && m_data->len(leaf) == route.len) {
+        return { true, true, leaf };
+    }
+
+    for (auto p = m_data->pre(leaf); p != NO_PREFIX; p = (*m_prefixes)[p].pre) {
+        const auto len = (*m_prefixes)[p].len;
+
+        if (len <= route.len) {
+            return { len == route.len, false, size_t(p) };
+        }
+    }
+
+    return { false, false, 0U };
+}
+
+/*
+ * Fills @path with the slots the walk for @route passes, from the root,
+ * and returns the index of the deepest one a local rebuild for the route
+ * can start from: no deeper than the route or the leaf the walk ends on
+ * when that covers it, and above any skipped bits the route does not share
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+size_t
+basic_lctrie<K, V, O, L, D, I>::update_path(const mapped_route &route, update_slot *path) const
+{
+    size_t count = 0U;
+    auto slot = update_slot{ 0U, 0U, 0U };
+    auto node = (*m_nodes)[0];
+
+    for (;;) {
+        path[count++] = slot;
+        node = (*m_nodes)[slot.pos];
+
+        if (node.branch == 0U) {
+            break;
+        }
+
+        const auto shared = slot.depth + node.skip;
+        const auto next = node.next +
+            extract(uint8_t(KEY_BITS - 1U - shared), node.branch, route.prefix);
+
+        slot = { next, shared + node.branch, shared };
+    }
+
+    const auto leaf = size_t(node.next);
+    const auto common = high_zero_count(key_type(m_data->key(leaf) ^ route.prefix));
+    const auto covers = m_data->len(leaf) <= route.len && common >= m_data->len(leaf);
+    const auto limit = covers ? size_t(m_data->len(leaf)) : size_t(route.len);
+    auto k = count - 1U;
+
+    while (k != 0U && (path[k].depth > limit || common < path[k].shared)) {
+        --k;
+    }
+
+    return k;
+}
+
+/*
+ * Inserts or erases @route by rebuilding one slot of the trie. The walk for
+ * the route's key finds the deepest slot whose fixed bits the route shares,
+ * so the skip and branch of every node above it still hold. A base route
+ * covering @route must become a prefix, so the slot has to hold it as well.
+ * If an erase empties the slot, its parent is rebuilt instead, so no slot
+ * ever has nothing to point at.
+ *
+ * The old subtrie is left in place and the new one is appended to m_nodes
+ * and m_data; once the garbage passes max_garbage, the trie is recompacted.
+ * With @in_place, an update that would rebuild from the root, recompact or
+ * outgrow the arrays returns no_room before touching anything.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::update(const mapped_route &route, const bool erase, const bool in_place)
+    -> update_status
+{
+    if (m_nodes->empty()) {
+        if (erase) {
+            return update_status::not_found;
+        }
+
+        if (in_place) {
+            return update_status::no_room;
+        }
+
+        rebuild({ route });
+        return update_status::applied;
+    }
+
+    update_slot path[KEY_BITS + 1U];
+    auto k = update_path(route, path);
+    collect_state state;
+
+    for (;; --k) {
+        state = { {}, NO_PREFIX, false, 0U, 0U, {} };
+        collect(path[k].pos, path[k].depth, path[k].depth,
+                key_type(route.prefix & prefix_mask(uint8_t(path[k].depth))), 0U, 0U, 0U, state);
+
+        auto &routes = state.routes;
+        std::sort(routes.begin(), routes.end(), route_less);
+        routes.erase(std::unique(routes.begin(), routes.end(), route_equal), routes.end());
+
+        const auto itr = std::lower_bound(routes.begin(), routes.end(), route, route_less);
+        const auto found = itr != routes.end() && route_equal(*itr, route);
+
+        if (erase) {
+            if (!found) {
+                return update_status::not_found;
+            }
+
+            routes.erase(itr);
+        } else if (found) {
+            itr->offset = route.offset;
+        } else {
+            routes.insert(itr, route);
+        }
+
+        if (!routes.empty() || k == 0U) {
+            break;
+        }
+    }
+
+    if (in_place && (k == 0U || !has_room(state))) {
+        return update_status::no_room;
+    }
+
+    if (k == 0U) {
+        rebuild(state.routes);
+        return update_status::applied;
+    }
+
+    const auto first = m_data->size();
+
+    m_dead_nodes += state.nodes;
+    m_dead_leaves += state.leaves;
+    add_routes(state.routes, state.outer);
+    make_node(*m_nodes, first, m_data->size() - first, path[k].depth, path[k].pos, 0U, nullptr);
+    advance_generation();
+
+    if (double(m_dead_nodes) > m_options.max_garbage * double(m_nodes->size()) ||
+        double(m_dead_leaves) > m_options.max_garbage * double(m_data->size())) {
+        recompact();
+    }
+
+    return update_status::applied;
+}
+
+/*
+ * Returns whether the slot holding @state can be rebuilt without growing
+ * any array past its capacity or the trie past max_garbage, so that the
+ * update never reallocates or recompacts under a concurrent lookup
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+bool
+basic_lctrie<K, V, O, L, D, I>::has_room(const collect_state &state) const
+{
+    const auto nkeys = state.routes.size();
+    const auto nodes = m_nodes->size() + max_nodes(nkeys);
+    const auto leaves = m_data->size() + nkeys;
+
+    return nodes <= m_nodes->capacity() && nodes <= MAX_NEXT + 1U &&
+        leaves <= m_data->capacity() && leaves <= MAX_NEXT + 1U &&
+        m_prefixes->size() + nkeys <= m_prefixes->capacity() &&
+        m_prefixes->size() + nkeys < NO_PREFIX &&
+        double(m_dead_nodes + state.nodes) <= m_options.max_garbage * double(m_nodes->size()) &&
+        double(m_dead_leaves + state.leaves) <= m_options.max_garbage * double(m_data->size());
+}
+
+/*
+ * Returns the generation of the routes: it changes on every update, and
+ * no two tries of one type, or two states of one trie, share one. Load it before a
+ * lookup, and the result of the lookup is valid in that generation.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+inline uint64_t
+basic_lctrie<K, V, O, L, D, I>::generation() const
+{
+    return m_generation.load(std::memory_order_acquire);
+}
+
+/*
+ * Gives the trie a fresh generation. An in-place update calls this after
+ * it publishes its slot, so a reader that sees the new generation also
+ * sees the new slot.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::advance_generation()
+{
+    static std::atomic<uint64_t> last{ 0U };
+
+    m_generation.store(last.fetch_add(1U, std::memory_order_relaxed) + 1U, std::memory_order_release);
+}
+
+/*
+ * Returns the number of distinct values held in m_vals
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+size_t
+basic_lctrie<K, V, O, L, D, I>::value_count() const
+{
+    return m_vals ? m_vals->size() : 0U;
+}
+
+/*
+ * Returns the bytes held by each array, and their sum over the number of
+ * routes stored
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::memory() const -> memory_usage
+{
+    memory_usage usage = {};
+
+    usage.nodes = m_nodes ? m_nodes->size() * sizeof(node_type) : 0U;
+    usage.leaves = m_data ? m_data->bytes() : 0U;
+    usage.prefixes = m_prefixes ? m_prefixes->size() * sizeof(prefix_type) : 0U;
+    usage.values = m_vals ? m_vals->size() * sizeof(value_type) : 0U;
+    usage.total = usage.nodes + usage.leaves + usage.prefixes + usage.values;
+
+    const auto routes = (m_data ? m_data->size() : 0U) + (m_prefixes ? m_prefixes->size() : 0U);
+
+    if (routes != 0U) {
+        usage.bytes_per_route = double(usage.total) / double(routes);
+    }
+
+    return usage;
+}
+
+/*
+ * Walks the trie to report its shape. A leaf counts when the walk for its
+ * own key ends on it, which leaves out those erase() left behind; every
+ * other reachable leaf slot is empty. Linear in the size of the trie.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::stats() const -> trie_stats
+{
+    trie_stats stats = {};
+
+    stats.memory = memory();
+    stats.branch.assign(MAX_BRANCH + 1U, 0U);
+    stats.skip.assign(KEY_BITS, 0U);
+
+    if (!m_nodes || m_nodes->empty()) {
+        return stats;
+    }
+
+    const auto &nodes = *m_nodes;
+    std::vector<size_t> pending = { 0U };
+    auto slots = size_t(0U);
+
+    stats.nodes = nodes.size();
+
+    while (!pending.empty()) {
+        const auto node = nodes[pending.back()];
+
+        pending.pop_back();
+        ++stats.reachable_nodes;
+
+        if (node.branch == 0U) {
+            ++slots;
+            continue;
+        }
+
+        ++stats.internal_nodes;
+        ++stats.branch[node.branch];
+        ++stats.skip[node.skip];
+
+        for (auto i = size_t(0U); i < (size_t(1U) << node.branch); ++i) {
+            pending.push_back(node.next + i);
+        }
+    }
+
+    auto total = size_t(0U);
+    std::vector<bool> seen(m_prefixes->size());
+
+    for (auto i = size_t(0U); i < m_data->size(); ++i) {
+        const auto key = m_data->key(i);
+        auto node = nodes[0];
+        auto pos = KEY_BITS - 1U;
+        auto depth = size_t(1U);
+
+        while (node.branch != 0U) {
+            pos -= node.skip;
+            const auto next = node.next + extract(uint8_t(pos), uint8_t(node.branch), key);
+            pos -= node.branch;
+            node = nodes[next];
+            ++depth;
+        }
+
+        if (node.next != i) {
+            continue;
+        }
+
+        if (stats.depth.size() <= depth) {
+            stats.depth.resize(depth + 1U);
+        }
+
+        ++stats.leaves;
+        ++stats.depth[depth];
+        total += depth;
+        stats.max_depth = std::max(stats.max_depth, depth);
+
+        // chains share their tails, so stop at the first prefix seen
+        for (auto pre = m_data->pre(i); pre != NO_PREFIX && !seen[pre]; pre = (*m_prefixes)[pre].pre) {
+            seen[pre] = true;
+            ++stats.prefixes;
+        }
+    }
+
+    stats.empty_slots = slots - stats.leaves;
+
+    if (stats.leaves != 0U) {
+        stats.average_depth = double(total) / double(stats.leaves);
+    }
+
+    return stats;
+}
+
+/*
+ * Returns every stored route, in (prefix, len) order
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::routes() const -> route_range
+{
+    return { route_iterator(this, 0U, 0U) };
+}
+
+/*
+ * Returns the stored routes @prefix/@len covers, itself included, in
+ * (prefix, len) order
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::routes(const key_type prefix, const uint8_t len) const -> route_range
+{
+    if (len > KEY_BITS) {
+        throw std::invalid_argument("lctrie: prefix length exceeds the key width");
+    }
+
+    return { route_iterator(this, key_type(prefix & prefix_mask(len)), len) };
+}
+
+/*
+ * Calls @fn with each route_type routes(@prefix, @len) visits
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+template <typename Fn>
+void
+basic_lctrie<K, V, O, L, D, I>::for_each_covered(const key_type prefix, const uint8_t len, Fn &&fn) const
+{
+    for (const auto &route : routes(prefix, len)) {
+        fn(route);
+    }
+}
+
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+basic_lctrie<K, V, O, L, D, I>::route_iterator::route_iterator(const basic_lctrie *trie,
+                                                               const key_type prefix, const uint8_t len)
+    : m_trie(trie),
+      m_prefix(prefix),
+      m_len(len)
+{
+    if (!trie->m_nodes || trie->m_nodes->empty()) {
+        m_trie = nullptr;
+        return;
+    }
+
+    const auto root = (*trie->m_nodes)[0];
+
+    if (root.branch == 0U) {
+        m_root_leaf = true;
+    } else {
+        const auto top = KEY_BITS - 1U - unsigned(root.skip);
+
+        m_frames[0] = { size_t(root.next), size_t(1U) << root.branch, 0U, 0U, 0U,
+                        top + 1U - unsigned(root.branch) };
+        m_depth = 1U;
+    }
+
+    ++*this;
+}
+
+/*
+ * Routes are unique, so the route an iterator is on is its position; every
+ * iterator past the last route is the end
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+inline bool
+basic_lctrie<K, V, O, L, D, I>::route_iterator::operator==(const route_iterator &other) const
+{
+    if (m_trie == nullptr || other.m_trie == nullptr) {
+        return m_trie == other.m_trie;
+    }
+
+    return m_trie == other.m_trie && m_route.prefix == other.m_route.prefix && m_route.len == other.m_route.len;
+}
+
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+inline bool
+basic_lctrie<K, V, O, L, D, I>::route_iterator::covers(const mapped_route &route) const
+{
+    return route.len >= m_len && ((route.prefix ^ m_prefix) & prefix_mask(m_len)) == 0U;
+}
+
+/*
+ * Finds the next live leaf in key order, skipping the children whose
+ * fixed bits leave the prefix; returns false when there is none
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+bool
+basic_lctrie<K, V, O, L, D, I>::route_iterator::next_leaf(size_t &leaf)
+{
+    const auto &nodes = *m_trie->m_nodes;
+
+    if (m_root_leaf) {
+        m_root_leaf = false;
+        leaf = nodes[0].next;
+        return true;
+    }
+
+    const auto filter = prefix_mask(m_len);
+
+    while (m_depth != 0U) {
+        auto &top = m_frames[m_depth - 1U];
+
+        if (top.index == top.count) {
+            --m_depth;
+            continue;
+        }
+
+        const auto index = top.index++;
+        const auto fixed = key_type(top.fixed | (key_type(index) << top.shift));
+        const auto mask = key_type(top.mask | (key_type(top.count - 1U) << top.shift));
+
+        if (((fixed ^ m_prefix) & mask & filter) != 0U) {
+            continue;
+        }
+
+        const auto node = nodes[top.next + index];
+
+        if (node.branch == 0U) {
+            leaf = node.next;
+
+            if (((m_trie->m_data->key(leaf) ^ fixed) & mask) == 0U) {
+                return true;
+            }
+
+            continue;
+        }
+
+        const auto high = top.shift - 1U - unsigned(node.skip);
+
+        m_frames[m_depth++] = { size_t(node.next), size_t(1U) << node.branch, 0U, fixed, mask,
+                                high + 1U - unsigned(node.branch) };
+    }
+
+    return false;
+}
+
+/*
+ * Moves to the next route: the next one of the current leaf, or else the
+ * next live leaf's prefixes and then the leaf itself. A prefix is emitted
+ * once, when the first leaf of its chain is; one that is already open,
+ * matched by its length since every open prefix covers the leaf, is not.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+auto
+basic_lctrie<K, V, O, L, D, I>::route_iterator::operator++() -> route_iterator &
+{
+    while (m_emitted == m_pending) {
+        size_t leaf;
+
+        if (!next_leaf(leaf)) {
+            m_trie = nullptr;
+            return *this;
+        }
+
+        const auto &data = *m_trie->m_data;
+        const auto &prefixes = *m_trie->m_prefixes;
+        const auto key = data.key(leaf);
+
+        while (m_opened != 0U && !is_prefix(m_open[m_opened - 1U], { key, data.len(leaf), 0U })) {
+            --m_opened;
+        }
+
+        // the chain runs longest first; take it in reverse
+        std::array<pre_type, KEY_BITS + 1U> chain;
+        auto length = size_t(0U);
+
+        for (auto pre = data.pre(leaf); pre != NO_PREFIX && length < chain.size(); pre = prefixes[pre].pre) {
+            chain[length++] = pre;
+        }
+
+        const auto opened = [this](const uint8_t len) {
+            for (auto i = size_t(0U); i < m_opened; ++i) {
+                if (m_open[i].len == len) {
+                    return true;
+                }
+            }
+
+            return false;
+        };
+
+        m_pending = 0U;
+        m_emitted = 0U;
+
+        while (length != 0U) {
+            const auto &prefix = prefixes[chain[--length]];
+            const auto route = mapped_route{ key_type(key & prefix_mask(prefix.len)), prefix.len, prefix.offset };
+
+            if (opened(route.len)) {
+                continue;
+            }
+
+            m_open[m_opened++] = route;
+
+            if (covers(route)) {
+                m_routes[m_pending++] = route;
+            }
+        }
+
+        const auto route = mapped_route{ key, data.len(leaf), data.offset(leaf) };
+
+        if (!opened(route.len) && covers(route)) {
+            m_routes[m_pending++] = route;
+        }
+    }
+
+    const auto &route = m_routes[m_emitted++];
+
+    m_route = { route.prefix, route.len, (*m_trie->m_vals)[route.offset] };
+    return *this;
+}
+
+/*
+ * Writes the trie as an image lctrie_view can map. The image goes to
+ * @path.tmp first and is renamed over @path, so processes that still map
+ * the old image keep it intact. Garbage left by insert() and erase() is
+ * written along; recompact() first to drop it. Values are copied as they
+ * are, so they have to mean the same in every process mapping the image.
+ */
+template <typename K, typename V, typename O, typename L, typename D, typename I>
+void
+basic_lctrie<K, V, O, L, D, I>::save(const std::string &path) const
+{
+    static_assert(std::is_trivially_copyable_v<value_type>, "lctrie: saved values must be trivially copyable");
+    static_assert(lctrie_image_header::LEAVES + data_array::SECTIONS <= lctrie_image_header::MAX_SECTIONS,
+                  "lctrie: too many leaf sections for the image header");
+
+    using header_type = lctrie_image_header;
+
+    const data_array none;
+    const auto &leaves = m_data ? *m_data : none;
+    const auto align = [](const size_t n) {
+        return (n + header_type::ALIGN - 1U) / header_type::ALIGN * header_type::ALIGN;
+    };
+
+    header_type header = {};
+    std::memcpy(header.magic, header_type::MAGIC, sizeof(header.magic));
+    header.version = header_type::VERSION;
+    header.endian = header_type::ENDIAN_MARK;
+    header.key_bytes = KEY_BYTES;
+    header.offset_bytes = sizeof(offset_type);
+    header.value_bytes = sizeof(value_type);
+    header.node_bytes = sizeof(node_type);
+    header.branch_bits = layout_type::BRANCH_BITS;
+    header.skip_bits = layout_type::SKIP_BITS;
+    header.next_bits = layout_type::NEXT_BITS;
+    header.leaf_layout = leaf_layout_type::ID;
+    header.nodes = m_nodes ? m_nodes->size() : 0U;
+    header.leaves = leaves.size();
+    header.prefixes = m_prefixes ? m_prefixes->size() : 0U;
+    header.values = m_vals ? m_vals->size() : 0U;
+    header.sections = header_type::LEAVES + data_array::SECTIONS;
+
+    std::array<leaf_section, header_type::LEAVES + data_array::SECTIONS> sections;
+    sections[header_type::NODES] = { m_nodes ? m_nodes->data() : nullptr, header.nodes * sizeof(node_type) };
+    sections[header_type::PREFIXES] = { m_prefixes ? m_prefixes->data() : nullptr, header.prefixes * sizeof(prefix_type) };
+    sections[header_type::VALUES] = { m_vals ? m_vals->data() : nullptr, header.values * sizeof(value_type) };
+
+    const auto leaf_sections = leaves.sections();
+    std::copy(leaf_sections.begin(), leaf_sections.end(), sections.begin() + header_type::LEAVES);
+
+    auto offset = align(sizeof(header));
+
+    for (auto i = size_t(0U); i < sections.size(); ++i) {
+        header.section[i] = { offset, sections[i].bytes };
+        offset = align(offset + sections[i].bytes);
+    }
+
+    header.size = offset;
+
+    const auto temp = path + ".tmp";
+    const auto file = std::fopen(temp.c_str(), "wb");
+
+    if (file == nullptr) {
+        throw std::system_error(errno, std::generic_category(), "lctrie: cannot create " + temp);
+    }
+
+    static const char zeros[header_type::ALIGN] = {};
+    auto written = sizeof(header);
+    auto ok = std::fwrite(&header, sizeof(header), 1U, file) == 1U;
+
+    const auto pad = [&](const size_t to) {
+        const auto n = to - written;
+        ok = ok && (n == 0U || std::fwrite(zeros, 1U, n, file) == n);
+        written = to;
+    };
+
+    for (auto i = size_t(0U); i < sections.size(); ++i) {
+        const auto bytes = sections[i].bytes;
+
+        pad(header.section[i].offset);
+        ok = ok && (bytes == 0U || std::fwrite(sections[i].data, 1U, bytes, file) == bytes);
+        written += bytes;
+    }
+
+    pad(header.size);
+    ok = std::fclose(file) == 0 && ok;
+
+    if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+        const auto error = errno;
+
+        std::remove(temp.c_str());
+        throw std::system_error(error, std::generic_category(), "lctrie: cannot write " + path);
+    }
+}
+
+/*
+ * Builds a trie from routes handed over a chunk at a time, so a table
+ * loaded from a dump never sits in memory as a whole route_input_type.
+ * Routes collect in a chunk of at most @chunk routes. A full chunk is
+ * run through ingest(), its values are interned, and it is kept as a
+ * sorted run of mapped routes, which take less than half the bytes of
+ * routes with pointer-sized values. With @spill the runs go to
+ * temporary files instead, and memory is bounded by the chunk, one read
+ * buffer per run and the trie itself. finish() merges the runs straight
+ * into the base and prefix vectors and builds the nodes in the same
+ * pass. Duplicates are resolved by the trie's duplicate policy, across
+ * chunks as within one.
+ *
+ * The target trie is left untouched until finish(), which replaces its
+ * routes as init() does and leaves the builder empty.
+ */
+template <typename Trie>
+struct lctrie_builder {
+    using trie_type = Trie;
+    using key_type = typename trie_type::key_type;
+    using value_type = typename trie_type::value_type;
+    using route_type = typename trie_type::route_type;
+    using route_input_type = typename trie_type::route_input_type;
+    using mapped_route = typename trie_type::mapped_route;
+
+    static constexpr size_t DEFAULT_CHUNK = size_t(1U) << 18U;
+
+    // routes a spilled run reads back at a time
+    static constexpr size_t READ_ROUTES = 4096U;
+
+    explicit lctrie_builder(trie_type &trie, size_t chunk = DEFAULT_CHUNK, bool spill = false);
+    ~lctrie_builder();
+
+    lctrie_builder(const lctrie_builder &) = delete;
+    lctrie_builder &operator=(const lctrie_builder &) = delete;
+
+    void push(const route_type &route);
+    void push(key_type prefix, uint8_t len, value_type value);
+    template <typename Iterator>
+    void push(Iterator first, Iterator last);
+    void finish();
+
+    // a sorted run; a spilled one holds the next routes read from file
+    struct run_type {
+        std::vector<mapped_route> routes;
+        size_t pos;
+        std::FILE *file;
+        size_t left;
+    };
+
+    void reset();
+    void flush();
+    bool refill(run_type &run);
+
+    trie_type &m_trie;
+    size_t m_chunk;
+    bool m_spill;
+
+    // interns the values and collects the routes finish() hands over
+    std::unique_ptr<trie_type> m_next;
+    route_input_type m_pending;
+    std::vector<run_type> m_runs;
+    size_t m_routes = 0U;
+};
+
+template <typename T>
+lctrie_builder<T>::lctrie_builder(trie_type &trie, const size_t chunk, const bool spill)
+    : m_trie(trie),
+      m_chunk(chunk),
+      m_spill(spill)
+{
+    if (chunk == 0U) {
+        throw std::invalid_argument("lctrie: a builder chunk must hold at least one route");
+    }
+
+    reset();
+}
+
+template <typename T>
+lctrie_builder<T>::~lctrie_builder()
+{
+    for (auto &run : m_runs) {
+        if (run.file != nullptr) {
+            std::fclose(run.file);
+        }
+    }
+}
+
+/*
+ * Drops every route pushed so far
+ */
+template <typename T>
+void
+lctrie_builder<T>::reset()
+{
+    for (auto &run : m_runs) {
+        if (run.file != nullptr) {
+            std::fclose(run.file);
+        }
+    }
+
+    m_runs.clear();
+    m_pending = route_input_type();
+    m_routes = 0U;
+    m_next = std::make_unique<trie_type>();
+    m_next->set_options(m_trie.m_options);
+    m_next->init_map(route_input_type(), nullptr);
+}
+
+template <typename T>
+inline void
+lctrie_builder<T>::push(const route_type &route)
+{
+    if (m_pending.empty()) {
+        m_pending.reserve(m_chunk);
+    }
+
+    m_pending.push_back(route);
+
+    if (m_pending.size() == m_chunk) {
+        flush();
+    }
+}
+
+template <typename T>
+inline void
+lctrie_builder<T>::push(const key_type prefix, const uint8_t len, const value_type value)
+{
+    push(route_type{ prefix, len, value });
+}
+
+template <typename T>
+template <typename Iterator>
+void
+lctrie_builder<T>::push(Iterator first, const Iterator last)
+{
+    for (; first != last; ++first) {
+        push(*first);
+    }
+}
+
+/*
+ * Sorts the pending chunk into a run, interning its values
+ */
+template <typename T>
+void
+lctrie_builder<T>::flush()
+{
+    if (m_pending.empty()) {
+        return;
+    }
+
+    m_next->ingest(m_pending);
+
+    run_type run = { {}, 0U, nullptr, 0U };
+
+    run.routes.reserve(m_pending.size());
+
+    for (const auto &route : m_pending) {
+        run.routes.push_back({ route.prefix, route.len, m_next->intern(route.value, m_next->m_value_map) });
+    }
+
+    m_routes += run.routes.size();
+    m_pending.clear();
+
+    if (m_spill) {
+        run.file = std::tmpfile();
+
+        if (run.file == nullptr) {
+            throw std::system_error(errno, std::generic_category(), "lctrie: cannot create a run file");
+        }
+
+        run.left = run.routes.size();
+        m_runs.push_back(std::move(run));
+
+        auto &spilled = m_runs.back();
+
+        if (std::fwrite(spilled.routes.data(), sizeof(mapped_route), spilled.left, spilled.file) !=
+                spilled.left ||
+            std::fflush(spilled.file) != 0 || std::fseek(spilled.file, 0L, SEEK_SET) != 0) {
+            throw std::system_error(errno, std::generic_category(), "lctrie: cannot write a run file");
+        }
+
+        spilled.routes.clear();
+        spilled.routes.shrink_to_fit();
+        return;
+    }
+
+    m_runs.push_back(std::move(run));
+}
+
+/*
+ * Makes the next routes of @run current; returns false once it is done
+ */
+template <typename T>
+bool
+lctrie_builder<T>::refill(run_type &run)
+{
+    if (run.pos < run.routes.size()) {
+        return true;
+    }
+
+    if (run.file == nullptr || run.left == 0U) {
+        run.routes = {};
+        return false;
+    }
+
+    const auto n = std::min(run.left, READ_ROUTES);
+
+    run.routes.resize(n);
+
+    if (std::fread(run.routes.data(), sizeof(mapped_route), n, run.file) != n) {
+        throw std::system_error(errno ? errno : EIO, std::generic_category(), "lctrie: cannot read a run file");
+    }
+
+    run.pos = 0U;
+    run.left -= n;
+    return true;
+}
+
+/*
+ * Merges the runs into the target trie and builds it. Runs are merged
+ * through a heap ordered by route, then by run, so of equal routes the
+ * one pushed last comes last; add_route() needs the route after each one,
+ * so the merge keeps one route in hand.
+ */
+template <typename T>
+void
+lctrie_builder<T>::finish()
+{
+    flush();
+    m_pending = route_input_type();
+
+    auto &next = *m_next;
+    const auto last_wins = next.m_options.duplicates == trie_type::duplicate_policy::last_wins;
+
+    // every leaf is a route, so this bounds the base vector
+    next.m_data->reserve(m_routes);
+
+    const auto later = [this](const size_t a, const size_t b) {
+        const auto &x = m_runs[a].routes[m_runs[a].pos];
+        const auto &y = m_runs[b].routes[m_runs[b].pos];
+        return trie_type::route_less(y, x) || (trie_type::route_equal(x, y) && a > b);
+    };
+
+    std::vector<size_t> heap;
+
+    for (auto i = size_t(0U); i < m_runs.size(); ++i) {
+        if (refill(m_runs[i])) {
+            heap.push_back(i);
+        }
+    }
+
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    typename trie_type::open_prefixes open;
+    mapped_route held = {};
+    auto holding = false;
+
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+
+        auto &run = m_runs[heap.back()];
+        const auto route = run.routes[run.pos++];
+
+        if (refill(run)) {
+            std::push_heap(heap.begin(), heap.end(), later);
+        } else {
+            heap.pop_back();
+        }
+
+        if (holding && trie_type::route_equal(held, route)) {
+            held = last_wins ? route : held;
+            continue;
+        }
+
+        if (holding) {
+            next.add_route(held, &route, open, trie_type::NO_PREFIX);
+        }
+
+        held = route;
+        holding = true;
+    }
+
+    if (holding) {
+        next.add_route(held, nullptr, open, trie_type::NO_PREFIX);
+    }
+
+    next.check_routes();
+
+    m_trie.m_data = std::move(next.m_data);
+    m_trie.m_prefixes = std::move(next.m_prefixes);
+    m_trie.m_vals = std::move(next.m_vals);
+    m_trie.m_value_map = std::move(next.m_value_map);
+    m_trie.m_dead_nodes = 0U;
+    m_trie.m_dead_leaves = 0U;
+    m_trie.init_trie();
+    reset();
+}
+
+/*
+ * A small cache of lookup results in front of a trie, owned by one thread.
+ * A multiplicative hash of the whole key picks a set of Ways entries; a
+ * miss walks the trie and fills an entry with plain stores, so the cache
+ * shares nothing with other threads. Each entry records the generation()
+ * it was read in, and updates move the trie to a new generation, so one
+ * store by the writer invalidates every cache at once.
+ */
+template <typename Trie, size_t Ways = 2U>
+struct lookup_cache {
+    using trie_type = Trie;
+    using key_type = typename trie_type::key_type;
+    using value_type = typename trie_type::value_type;
+
+    static_assert(Ways == 1U || Ways == 2U, "lctrie: a lookup cache is direct mapped or 2-way");
+
+    static constexpr size_t DEFAULT_SETS = 1024U;
+
+    // no trie is ever in generation 0, so a fresh entry never hits
+    struct entry {
+        key_type key;
+        value_type value;
+        uint64_t generation;
+    };
+
+    struct cache_stats {
+        uint64_t hits;
+        uint64_t misses;
+        double hit_rate;
+    };
+
+    explicit lookup_cache(size_t sets = DEFAULT_SETS);
+
+    value_type lookup(const trie_type &trie, key_type key);
+    void clear();
+    cache_stats stats() const;
+    size_t index(key_type key) const;
+
+    cache_vector<entry> m_entries;
+    size_t m_mask;
+    uint64_t m_hits = 0U;
+    uint64_t m_misses = 0U;
+};
+
+template <typename T, size_t W>
+lookup_cache<T, W>::lookup_cache(const size_t sets)
+    : m_mask(sets - 1U)
+{
+    if (sets == 0U || (sets & m_mask) != 0U || sets > (size_t(1U) << 32)) {
+        throw std::invalid_argument("lctrie: cache sets must be a power of two up to 2^32");
+    }
+
+    m_entries.resize(sets * W, entry{ key_type(0U), value_type(), 0U });
+}
+
+/*
+ * Returns the set of @key: the high half of the low 64 bits of key times
+ * 2^64 / phi depends on every bit of the key
+ */
+template <typename T, size_t W>
+inline size_t
+lookup_cache<T, W>::index(const key_type key) const
+{
+    auto word = uint64_t(key);
+
+    if constexpr (sizeof(key_type) > sizeof(uint64_t)) {
+        word ^= uint64_t(key >> 64);
+    }
+
+    return size_t((word * 0x9e3779b97f4a7c15U) >> 32) & m_mask;
+}
+
+/*
+ * Returns trie.lookup(@key), from the cache when it holds the key in the
+ * current generation. A 2-way set fills its first way and moves the entry
+ * there to the second, unless that entry is stale already.
+ */
+template <typename T, size_t W>
+inline auto
+lookup_cache<T, W>::lookup(const trie_type &trie, const key_type key) -> value_type
+{
+    const auto generation = trie.generation();
+    auto *set = &m_entries[index(key) * W];
+
+    for (auto way = size_t(0U); way < W; ++way) {
+        if (set[way].generation == generation && set[way].key == key) {
+            ++m_hits;
+            return set[way].value;
+        }
+    }
+
+    ++m_misses;
+
+    const auto value = trie.lookup(key);
+
+    if (W == 2U && set[0].generation == generation) {
+        set[W - 1U] = set[0];
+    }
+
+    set[0] = { key, value, generation };
+    return value;
+}
+
+/*
+ * Drops every entry and zeroes the counters
+ */
+template <typename T, size_t W>
+void
+lookup_cache<T, W>::clear()
+{
+    std::fill(m_entries.begin(), m_entries.end(), entry{ key_type(0U), value_type(), 0U });
+    m_hits = 0U;
+    m_misses = 0U;
+}
+
+template <typename T, size_t W>
+auto
+lookup_cache<T, W>::stats() const -> cache_stats
+{
+    const auto lookups = m_hits + m_misses;
+
+    return { m_hits, m_misses, lookups == 0U ? 0.0 : double(m_hits) / double(lookups) };
+}
+
+#if defined(LCTRIE_COROUTINES)
+/*
+ * Keeps up to width() lookups in flight without the caller gathering keys
+ * into batches. Each slot is a coroutine that walks one key at a time: at
+ * every level it prefetches the node it reads next and suspends, and the
+ * slots are resumed round robin, so by the time a slot comes around again
+ * its node has usually arrived and the misses of the slots overlap the way
+ * those of a lookup_batch() do. push() hands a key to the next free slot,
+ * stepping the walks in flight until one completes, and the result is
+ * stored at the out pointer when the walk completes; drain() completes
+ * every walk in flight. A burst of any size can be pushed one key at a
+ * time, with other per-packet work in between.
+ *
+ * The coroutine frames are allocated once, by the constructor, so a lookup
+ * allocates nothing. A lookup reads the trie it was pushed with until it
+ * completes, so that trie must not be updated or freed before drain().
+ */
+template <typename Trie>
+struct interleaved_lookup {
+    using trie_type = Trie;
+    using key_type = typename trie_type::key_type;
+    using value_type = typename trie_type::value_type;
+    using tables_type = typename trie_type::template table_view<typename trie_type::data_array>;
+
+    // lookups in flight; the overlap stops paying off at about this many
+    static constexpr size_t DEFAULT_WIDTH = 16U;
+
+    // the key a slot walks and where its result goes
+    struct slot {
+        tables_type tables;
+        key_type key;
+        value_type *out;
+        bool busy;
+    };
+
+    // owns the frame of one slot's coroutine
+    struct walk {
+        struct promise_type {
+            walk get_return_object() { return walk(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+
+        explicit walk(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+        walk(walk &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+        walk &operator=(walk &&other) = delete;
+        ~walk() { if (m_handle) m_handle.destroy(); }
+
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    // prefetches what the walk reads next, then suspends it
+    struct fetch {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<>) const noexcept { prefetch(m_ptr); }
+        void await_resume() const noexcept {}
+
+        const void *m_ptr;
+    };
+
+    explicit interleaved_lookup(size_t width = DEFAULT_WIDTH);
+    interleaved_lookup(const interleaved_lookup &other) = delete;
+    interleaved_lookup &operator=(const interleaved_lookup &other) = delete;
+
+    void push(const trie_type &trie, key_type key, value_type *out);
+    void drain();
+    void lookup_batch(const trie_type &trie, const key_type *keys, value_type *out, size_t n);
+    size_t width() const;
+    size_t in_flight() const;
+    bool step(size_t i);
+    static walk run(slot &s);
+
+    std::unique_ptr<slot[]> m_slots;
+    std::vector<walk> m_walks;
+    size_t m_next = 0U;
+    size_t m_in_flight = 0U;
+};
+
+template <typename T>
+interleaved_lookup<T>::interleaved_lookup(const size_t width)
+{
+    if (width == 0U) {
+        throw std::invalid_argument("lctrie: an interleaved lookup needs at least one slot");
+    }
+
+    m_slots.reset(new slot[width]());
+    m_walks.reserve(width);
+
+    for (size_t i = 0U; i < width; ++i) {
+        m_walks.push_back(run(m_slots[i]));
+    }
+}
+
+/*
+ * The walk of one slot, as find() does it. It starts suspended and, after
+ * each lookup, suspends idle until push() hands it the next key. A slot at
+ * its leaf keeps the node it read, as the lanes of find_batch() do.
+ */
+template <typename T>
+auto
+interleaved_lookup<T>::run(slot &s) -> walk
+{
+    for (;;) {
+        const auto t = s.tables;
+        const auto key = s.key;
+        auto node = trie_type::load_node(t.nodes[0]);
+        auto pos = trie_type::KEY_BITS - 1U;
+        auto levels = size_t(1U);
+
+        while (node.branch != 0U) {
+            pos -= node.skip;
+            const auto next = node.next + trie_type::extract(pos, node.branch, key);
+            pos -= node.branch;
+            co_await fetch{ &t.nodes[next] };
+            node = trie_type::load_node(t.nodes[next]);
+            ++levels;
+        }
+
+        trie_type::instrument_type::walk(1U, levels);
+        co_await fetch{ t.leaves->address(node.next) };
+        *s.out = trie_type::find_leaf(t, node.next, key);
+        s.busy = false;
+        co_await std::suspend_always{};
+    }
+}
+
+/*
+ * Resumes the walk of slot @i up to its next fetch; returns whether the
+ * slot is free afterwards
+ */
+template <typename T>
+inline bool
+interleaved_lookup<T>::step(const size_t i)
+{
+    m_walks[i].m_handle.resume();
+
+    if (m_slots[i].busy) {
+        return false;
+    }
+
+    --m_in_flight;
+    return true;
+}
+
+/*
+ * Starts the lookup of @key in @trie; its value is stored at @out by the
+ * time the next drain() returns, or sooner
+ */
+template <typename T>
+void
+interleaved_lookup<T>::push(const trie_type &trie, const key_type key, value_type *out)
+{
+    if (!trie.m_has_root) {
+        *out = trie_type::NO_VALUE;
+        return;
+    }
+
+    // each walk in flight takes one step until the slot in turn is free
+    while (m_slots[m_next].busy && !step(m_next)) {
+        m_next = m_next + 1U == width() ? 0U : m_next + 1U;
+    }
+
+    m_slots[m_next] = { trie.tables(), key, out, true };
+    ++m_in_flight;
+    step(m_next);
+    m_next = m_next + 1U == width() ? 0U : m_next + 1U;
+}
+
+/*
+ * Steps the walks in flight round robin until all of them are complete
+ */
+template <typename T>
+void
+interleaved_lookup<T>::drain()
+{
+    for (auto i = m_next; m_in_flight != 0U; i = i + 1U == width() ? 0U : i + 1U) {
+        if (m_slots[i].busy) {
+            step(i);
+        }
+    }
+}
+
+/*
+ * Looks up @n keys into @out, width() at a time
+ */
+template <typename T>
+void
+interleaved_lookup<T>::lookup_batch(
+    const trie_type &trie,
+    const key_type *keys,
+    value_type *out,
+    const size_t n)
+{
+    for (size_t i = 0U; i < n; ++i) {
+        push(trie, keys[i], out + i);
+    }
+
+    drain();
+}
+
+template <typename T>
+inline size_t
+interleaved_lookup<T>::width() const
+{
+    return m_walks.size();
+}
+
+template <typename T>
+inline size_t
+interleaved_lookup<T>::in_flight() const
+{
+    return m_in_flight;
+}
+#endif
+
+/*
+ * A trie shared by many lookup threads and one updating thread. Lookups
+ * take no locks and make no atomic read-modify-writes: they load the
+ * current trie with acquire semantics and run the plain lookup.
+ *
+ * The writer first tries each update in place (try_insert(), try_erase()
+ * or try_apply_batch()), which only publishes a slot word. When that has
+ * no room, it rebuilds a compact copy, applies the update and reserves
+ * fresh headroom there, then publishes the copy with a single pointer
+ * store. The old copy is retired and freed by quiescent-state based
+ * reclamation: every reader announces, at points where it holds no pointer
+ * into the trie, the last epoch it has seen, and a copy retired at epoch e
+ * is freed once every online reader has announced e or later.
+ *
+ * Constructed with a list of NUMA nodes, it keeps one replica of the trie
+ * per node, each in an arena of that node's memory, and every reader reads
+ * the replica of the node it registered on. The writer updates the first
+ * replica and repeats each in-place update on the others, which are exact
+ * copies and so apply it the same way; a rebuilt copy is replicated to
+ * every node before any of them is published, and all of them are retired
+ * at one epoch. An update returns once every node sees it.
+ */
+template <typename Trie>
+struct concurrent_lctrie {
+    using trie_type = Trie;
+    using key_type = typename trie_type::key_type;
+    using value_type = typename trie_type::value_type;
+    using route_input_type = typename trie_type::route_input_type;
+    using build_options = typename trie_type::build_options;
+    using update_status = typename trie_type::update_status;
+    using prefix_input_type = typename trie_type::prefix_input_type;
+    using batch_result = typename trie_type::batch_result;
+
+    // the epoch of a reader that holds no pointer into the trie
+    static constexpr uint64_t OFFLINE = ~uint64_t(0);
+
+    // alone on its cache line, so readers do not contend on announcements
+    struct alignas(64) reader_slot {
+        std::atomic<uint64_t> epoch{ OFFLINE };
+    };
+
+    // the trie the readers of one NUMA node load, on its own cache line
+    // so publishing to one node does not invalidate the others' copy
+    struct alignas(64) replica_slot {
+        std::atomic<const trie_type *> current{ nullptr };
+    };
+
+    // the handle a lookup thread uses; it starts out online
+    struct reader {
+        value_type lookup(key_type key) const;
+        template <size_t Ways>
+        value_type lookup(key_type key, lookup_cache<trie_type, Ways> &cache) const;
+        void lookup_batch(const key_type *keys, value_type *out, size_t n) const;
+#if defined(LCTRIE_COROUTINES)
+        void lookup(key_type key, value_type *out, interleaved_lookup<trie_type> &lookups) const;
+#endif
+        void quiescent() const;
+        void offline() const;
+        void online() const;
+
+        const concurrent_lctrie *m_owner;
+        reader_slot *m_slot;
+        const replica_slot *m_replica;
+    };
+
+    explicit concurrent_lctrie(size_t max_readers, double headroom = 0.5);
+    concurrent_lctrie(size_t max_readers, double headroom, const std::vector<int> &numa_nodes);
+
+    reader register_reader();
+    reader register_reader(int numa_node);
+
+    // writer side; only one thread may call these at a time
+    void set_options(const build_options &options);
+    void init(const route_input_type &routes);
+    void insert(key_type prefix, uint8_t len, value_type value);
+    bool erase(key_type prefix, uint8_t len);
+    batch_result apply_batch(const route_input_type &adds, const prefix_input_type &withdraws);
+    void reclaim();
+    void synchronize();
+
+    void publish(std::unique_ptr<trie_type> next);
+    template <typename Fn>
+    void replicate_update(Fn &&apply);
+    uint64_t min_epoch() const;
+
+    double m_headroom;
+    size_t m_max_readers;
+    std::atomic<size_t> m_reader_count{ 0U };
+    std::unique_ptr<reader_slot[]> m_readers;
+
+    // the node of each replica; empty when not replicating
+    std::vector<int> m_numa_nodes;
+    std::unique_ptr<replica_slot[]> m_current;
+    std::atomic<uint64_t> m_epoch{ 0U };
+
+    // the writer's trie, which is the first replica, and the others
+    std::unique_ptr<trie_type> m_trie;
+    std::vector<std::unique_ptr<trie_type>> m_replicas;
+    std::vector<std::pair<uint64_t, std::unique_ptr<trie_type>>> m_retired;
+};
+
+template <typename T>
+concurrent_lctrie<T>::concurrent_lctrie(const size_t max_readers, const double headroom)
+    : concurrent_lctrie(max_readers, headroom, std::vector<int>())
+{
+}
+
+/*
+ * Replicates the trie to each of @numa_nodes, e.g. those numa_nodes()
+ * returns; an empty list keeps one trie wherever the writer allocates it
+ */
+template <typename T>
+concurrent_lctrie<T>::concurrent_lctrie(const size_t max_readers, const double headroom,
+                                        const std::vector<int> &numa_nodes)
+    : m_headroom(headroom),
+      m_max_readers(max_readers),
+      m_readers(std::make_unique<reader_slot[]>(max_readers)),
+      m_numa_nodes(numa_nodes),
+      m_current(std::make_unique<replica_slot[]>(std::max<size_t>(numa_nodes.size(), 1U))),
+      m_trie(std::make_unique<trie_type>())
+{
+    if (!(headroom >= 0.0)) {
+        throw std::invalid_argument("lctrie: headroom must not be negative");
+    }
+
+    for (const auto node : m_numa_nodes) {
+        if (node < 0) {
+            throw std::invalid_argument("lctrie: NUMA nodes must not be negative");
+        }
+    }
+
+    auto options = m_trie->m_options;
+
+    if (!m_numa_nodes.empty()) {
+        options.numa_node = m_numa_nodes[0];
+    }
+
+    m_trie->set_options(options);
+    m_trie->init(route_input_type());
+    m_trie->reserve_headroom(m_headroom);
+
+    for (auto r = size_t(1U); r < m_numa_nodes.size(); ++r) {
+        m_replicas.push_back(m_trie->replicate(m_numa_nodes[r]));
+    }
+
+    m_current[0].current.store(m_trie.get(), std::memory_order_release);
+
+    for (auto r = size_t(1U); r < m_numa_nodes.size(); ++r) {
+        m_current[r].current.store(m_replicas[r - 1U].get(), std::memory_order_release);
+    }
+}
+
+/*
+ * Claims a reader slot for the calling thread, reading the replica of the
+ * NUMA node it runs on; a thread that may migrate should be pinned first
+ */
+template <typename T>
+auto
+concurrent_lctrie<T>::register_reader() -> reader
+{
+    return register_reader(m_numa_nodes.empty() ? 0 : current_numa_node());
+}
+
+/*
+ * As register_reader(), reading the replica of @numa_node, or the first one
+ * when no replica is on that node
+ */
+template <typename T>
+auto
+concurrent_lctrie<T>::register_reader(const int numa_node) -> reader
+{
+    const auto i = m_reader_count.fetch_add(1U, std::memory_order_relaxed);
+
+    if (i >= m_max_readers) {
+        throw std::length_error("lctrie: too many readers");
+    }
+
+    const auto node = std::find(m_numa_nodes.begin(), m_numa_nodes.end(), numa_node);
+    const auto r = node == m_numa_nodes.end() ? size_t(0U) : size_t(node - m_numa_nodes.begin());
+    const auto handle = reader{ this, &m_readers[i], &m_current[r] };
+
+    handle.online();
+    return handle;
+}
+
+template <typename T>
+inline auto
+concurrent_lctrie<T>::reader::lookup(const key_type key) const -> value_type
+{
+    return m_replica->current.load(std::memory_order_acquire)->lookup(key);
+}
+
+/*
+ * As lookup(), through the calling thread's @cache. A copy published by
+ * the writer has a generation of its own, so entries read from the last
+ * copy miss.
+ */
+template <typename T>
+template <size_t W>
+inline auto
+concurrent_lctrie<T>::reader::lookup(const key_type key, lookup_cache<trie_type, W> &cache) const
+    -> value_type
+{
+    return cache.lookup(*m_replica->current.load(std::memory_order_acquire), key);
+}
+
+template <typename T>
+inline void
+concurrent_lctrie<T>::reader::lookup_batch(const key_type *keys, value_type *out, const size_t n) const
+{
+    m_replica->current.load(std::memory_order_acquire)->lookup_batch(keys, out, n);
+}
+
+#if defined(LCTRIE_COROUTINES)
+/*
+ * Pushes the lookup of @key onto the calling thread's @lookups. The walk
+ * reads the copy that is current now, which stays alive while the reader
+ * is online, so lookups.drain() has to come before quiescent().
+ */
+template <typename T>
+inline void
+concurrent_lctrie<T>::reader::lookup(
+    const key_type key,
+    value_type *out,
+    interleaved_lookup<trie_type> &lookups) const
+{
+    lookups.push(*m_replica->current.load(std::memory_order_acquire), key, out);
+}
+#endif
+
+/*
+ * Announces that the thread holds no pointer into the trie. A forwarding
+ * loop calls this once per burst; the release store orders every earlier
+ * lookup before the announcement, so no fence is needed.
+ */
+template <typename T>
+inline void
+concurrent_lctrie<T>::reader::quiescent() const
+{
+    m_slot->epoch.store(m_owner->m_epoch.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+/*
+ * Stops the writer from waiting on this thread, e.g. before it blocks
+ */
+template <typename T>
+void
+concurrent_lctrie<T>::reader::offline() const
+{
+    m_slot->epoch.store(OFFLINE, std::memory_order_release);
+}
+
+/*
+ * Rejoins after offline(). The fence keeps the announcement from being
+ * reordered after the next load of the trie pointer, which the writer
+ * could otherwise free in between.
+ */
+template <typename T>
+void
+concurrent_lctrie<T>::reader::online() const
+{
+    m_slot->epoch.store(m_owner->m_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/*
+ * Rebuilds the routes held under @options; when replicating, each replica
+ * keeps to its own node whatever numa_node says
+ */
+template <typename T>
+void
+concurrent_lctrie<T>::set_options(const build_options &options)
+{
+    auto next = m_trie->clone();
+    auto placed = options;
+
+    if (!m_numa_nodes.empty()) {
+        placed.numa_node = m_numa_nodes[0];
+    }
+
+    next->set_options(placed);
+    next->recompact();
+    next->reserve_headroom(m_headroom);
+    publish(std::move(next));
+}
+
+/*
+ * Replaces the routes with @routes, under the current options. They are
+ * taken in any order: a copy goes through ingest(), so host bits are
+ * cleared and duplicates resolved by the duplicates option.
+ */
+template <typename T>
+void
+concurrent_lctrie<T>::init(const route_input_type &routes)
+{
+    auto next = std::make_unique<trie_type>();
+    auto ingested = routes;
+
+    next->set_options(m_trie->m_options);
+    next->ingest(ingested);
+    next->init(ingested);
+    next->reserve_headroom(m_headroom);
+    publish(std::move(next));
+}
+
+template <typename T>
+void
+concurrent_lctrie<T>::insert(const key_type prefix, const uint8_t len, const value_type value)
+{
+    if (m_trie->try_insert(prefix, len, value) == update_status::applied) {
+        replicate_update([prefix, len, value](trie_type &replica) {
+            return replica.try_insert(prefix, len, value);
+        });
+        return;
+    }
+
+    auto next = m_trie->clone();
+
+    next->insert(prefix, len, value);
+    next->reserve_headroom(m_headroom);
+    publish(std::move(next));
+}
+
+template <typename T>
+bool
+concurrent_lctrie<T>::erase(const key_type prefix, const uint8_t len)
+{
+    const auto status = m_trie->try_erase(prefix, len);
+
+    if (status != update_status::no_room) {
+        if (status == update_status::applied) {
+            replicate_update([prefix, len](trie_type &replica) { return replica.try_erase(prefix, len); });
+        }
+
+        return status == update_status::applied;
+    }
+
+    auto next = m_trie->clone();
+    const auto erased = next->erase(prefix, len);
+
+    next->reserve_headroom(m_headroom);
+    publish(std::move(next));
+    return erased;
+}
+
+/*
+ * Applies a batch as trie_type::try_apply_batch() does, on the current trie
+ * and its replicas, where a lookup sees either none of the batch or all of
+ * it. A batch that does not fit in the headroom is applied to a
+ * recompacted copy instead, which is then published.
+ */
+template <typename T>
+auto
+concurrent_lctrie<T>::apply_batch(const route_input_type &adds, const prefix_input_type &withdraws)
+    -> batch_result
+{
+    batch_result result;
+
+    if (m_trie->try_apply_batch(adds, withdraws, result) == update_status::applied) {
+        replicate_update([&adds, &withdraws](trie_type &replica) {
+            batch_result same;
+            return replica.try_apply_batch(adds, withdraws, same);
+        });
+        return result;
+    }
+
+    auto next = m_trie->clone();
+
+    result = next->apply_batch(adds, withdraws);
+    next->reserve_headroom(m_headroom);
+    publish(std::move(next));
+    return result;
+}
+
+/*
+ * Makes @next the trie lookups see and retires the current one. When
+ * replicating, every replica of @next is made before the first is
+ * published, so a failed copy leaves all nodes on the current trie.
+ */
+template <typename T>
+void
+concurrent_lctrie<T>::publish(std::unique_ptr<trie_type> next)
+{
+    const auto epoch = m_epoch.load(std::memory_order_relaxed) + 1U;
+    std::vector<std::unique_ptr<trie_type>> replicas;
+
+    if (!m_numa_nodes.empty()) {
+        // the writer's copy is the first node's replica
+        if (next->m_options.numa_node != m_numa_nodes[0]) {
+            next = next->replicate(m_numa_nodes[0]);
+        }
+
+        for (auto r = size_t(1U); r < m_numa_nodes.size(); ++r) {
+            replicas.push_back(next->replicate(m_numa_nodes[r]));
+        }
+    }
+
+    m_current[0].current.store(next.get(), std::memory_order_release);
+
+    for (auto r = size_t(0U); r < replicas.size(); ++r) {
+        m_current[r + 1U].current.store(replicas[r].get(), std::memory_order_release);
+    }
+
+    m_retired.push_back({ epoch, std::move(m_trie) });
+
+    for (auto &replica : m_replicas) {
+        m_retired.push_back({ epoch, std::move(replica) });
+    }
+
+    m_trie = std::move(next);
+    m_replicas = std::move(replicas);
+    m_epoch.store(epoch, std::memory_order_release);
+    reclaim();
+}
+
+/*
+ * Repeats on the other replicas the in-place update @apply made to the
+ * writer's trie. An exact copy always applies it too; should one not,
+ * every node gets a fresh copy of the writer's trie instead.
+ */
+template <typename T>
+template <typename Fn>
+void
+concurrent_lctrie<T>::replicate_update(Fn &&apply)
+{
+    for (auto &replica : m_replicas) {
+        if (apply(*replica) != update_status::applied) {
+            auto next = m_trie->clone();
+
+            next->reserve_headroom(m_headroom);
+            publish(std::move(next));
+            return;
+        }
+    }
+}
+
+/*
+ * Returns the oldest epoch an online reader may still be using
+ */
+template <typename T>
+uint64_t
+concurrent_lctrie<T>::min_epoch() const
+{
+    const auto count = std::min(m_reader_count.load(std::memory_order_relaxed), m_max_readers);
+    auto epoch = OFFLINE;
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    for (auto i = size_t(0U); i < count; ++i) {
+        epoch = std::min(epoch, m_readers[i].epoch.load(std::memory_order_acquire));
+    }
+
+    return epoch;
+}
+
+/*
+ * Frees the retired tries no reader can be using, without waiting
+ */
+template <typename T>
+void
+concurrent_lctrie<T>::reclaim()
+{
+    const auto epoch = min_epoch();
+
+    m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+                                   [epoch](const auto &retired) { return retired.first <= epoch; }),
+                    m_retired.end());
+}
+
+/*
+ * Waits until every retired trie has been freed
+ */
+template <typename T>
+void
+concurrent_lctrie<T>::synchronize()
+{
+    while (!m_retired.empty()) {
+        reclaim();
+    }
+}
+
+/*
+ * A trie image written by save(), mapped read-only and served in place.
+ * Opening one costs a mapping and a check of the header, and processes
+ * that map the same image share one page cache copy of it. Past the
+ * header the image is trusted like the trie that wrote it.
+ */
+template <typename Trie>
+struct lctrie_view {
+    using trie_type = Trie;
+    using key_type = typename trie_type::key_type;
+    using value_type = typename trie_type::value_type;
+    using leaf_view = typename trie_type::data_array::view_type;
+    using table_type = typename trie_type::template table_view<leaf_view>;
+    using header_type = lctrie_image_header;
+
+    explicit lctrie_view(const std::string &path);
+    ~lctrie_view();
+
+    lctrie_view(const lctrie_view &) = delete;
+    lctrie_view &operator=(const lctrie_view &) = delete;
+
+    value_type lookup(key_type key) const;
+    void lookup_batch(const key_type *keys, value_type *out, size_t n) const;
+
+    void map(const std::string &path);
+    void unmap();
+    void check();
+
+    const char *m_image = nullptr;
+    size_t m_size = 0U;
+    bool m_mapped = false;
+    const header_type *m_header = nullptr;
+    std::unique_ptr<leaf_view> m_leaves;
+    size_t m_leaf_bytes = 0U;
+    table_type m_tables = {};
+};
+
+template <typename T>
+lctrie_view<T>::lctrie_view(const std::string &path)
+{
+    map(path);
+
+    try {
+        check();
+    } catch (...) {
+        unmap();
+        throw;
+    }
+}
+
+template <typename T>
+lctrie_view<T>::~lctrie_view()
+{
+    unmap();
+}
+
+/*
+ * Maps @path, or where there is no mmap() reads it into memory
+ */
+template <typename T>
+void
+lctrie_view<T>::map(const std::string &path)
+{
+#if defined(LCTRIE_POSIX)
+    const auto fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "lctrie: cannot open " + path);
+    }
+
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0 || st.st_size < off_t(sizeof(header_type))) {
+        const auto error = errno;
+
+        ::close(fd);
+        throw std::system_error(error != 0 ? error : EINVAL, std::generic_category(),
+                                "lctrie: cannot map " + path);
+    }
+
+    const auto image = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    const auto error = errno;
+
+    ::close(fd);
+
+    if (image == MAP_FAILED) {
+        throw std::system_error(error, std::generic_category(), "lctrie: cannot map " + path);
+    }
+
+    m_image = static_cast<const char *>(image);
+    m_size = size_t(st.st_size);
+    m_mapped = true;
+#else
+    const auto file = std::fopen(path.c_str(), "rb");
+
+    if (file == nullptr) {
+        throw std::system_error(errno, std::generic_category(), "lctrie: cannot open " + path);
+    }
+
+    std::fseek(file, 0, SEEK_END);
+    const auto size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+
+    if (size < long(sizeof(header_type))) {
+        std::fclose(file);
+        throw std::runtime_error("lctrie: " + path + " is not a trie image");
+    }
+
+    const auto image = static_cast<char *>(::operator new(size_t(size), std::align_val_t(header_type::ALIGN)));
+
+    if (std::fread(image, 1U, size_t(size), file) != size_t(size)) {
+        std::fclose(file);
+        ::operator delete(image, std::align_val_t(header_type::ALIGN));
+        throw std::runtime_error("lctrie: cannot read " + path);
+    }
+
+    std::fclose(file);
+    m_image = image;
+    m_size = size_t(size);
+#endif
+}
+
+template <typename T>
+void
+lctrie_view<T>::unmap()
+{
+    if (m_image == nullptr) {
+        return;
+    }
+
+#if defined(LCTRIE_POSIX)
+    if (m_mapped) {
+        ::munmap(const_cast<char *>(m_image), m_size);
+    }
+#else
+    ::operator delete(const_cast<char *>(m_image), std::align_val_t(header_type::ALIGN));
+#endif
+
+    m_image = nullptr;
+}
+
+/*
+ * Checks that the image was written for trie_type on a machine of the same
+ * byte order and that every section lies within it, then points the
+ * tables at the sections
+ */
+template <typename T>
+void
+lctrie_view<T>::check()
+{
+    using data_array = typename trie_type::data_array;
+    using layout_type = typename trie_type::layout_type;
+
+    const auto header = reinterpret_cast<const header_type *>(m_image);
+
+    if (std::memcmp(header->magic, header_type::MAGIC, sizeof(header->magic)) != 0) {
+        throw std::runtime_error("lctrie: not a trie image");
+    }
+
+    if (header->version != header_type::VERSION || header->endian != header_type::ENDIAN_MARK) {
+        throw std::runtime_error("lctrie: unsupported image version or byte order");
+    }
+
+    if (header->key_bytes != trie_type::KEY_BYTES ||
+        header->offset_bytes != sizeof(typename trie_type::offset_type) ||
+        header->value_bytes != sizeof(value_type) ||
+        header->node_bytes != sizeof(typename trie_type::node_type) ||
+        header->branch_bits != layout_type::BRANCH_BITS ||
+        header->skip_bits != layout_type::SKIP_BITS ||
+        header->next_bits != layout_type::NEXT_BITS ||
+        header->leaf_layout != trie_type::leaf_layout_type::ID ||
+        header->sections != header_type::LEAVES + data_array::SECTIONS) {
+        throw std::runtime_error("lctrie: image was written for another trie type");
+    }
+
+    std::array<uint64_t, header_type::LEAVES + data_array::SECTIONS> bytes;
+    bytes[header_type::NODES] = header->nodes * sizeof(typename trie_type::node_type);
+    bytes[header_type::PREFIXES] = header->prefixes * sizeof(typename trie_type::prefix_type);
+    bytes[header_type::VALUES] = header->values * sizeof(value_type);
+
+    const auto leaf_bytes = data_array::section_bytes(size_t(header->leaves));
+    std::copy(leaf_bytes.begin(), leaf_bytes.end(), bytes.begin() + header_type::LEAVES);
+
+    std::array<const void *, data_array::SECTIONS> leaves;
+
+    for (auto i = size_t(0U); i < bytes.size(); ++i) {
+        const auto &section = header->section[i];
+
+        if (section.bytes != bytes[i] || section.offset % header_type::ALIGN != 0U ||
+            section.offset > m_size || section.bytes > m_size - section.offset) {
+            throw std::runtime_error("lctrie: truncated or corrupt image");
+        }
+
+        if (i >= header_type::LEAVES) {
+            leaves[i - header_type::LEAVES] = m_image + section.offset;
+        }
+    }
+
+    m_header = header;
+    m_leaves = std::make_unique<leaf_view>(leaves);
+    m_leaf_bytes = 0U;
+
+    for (const auto section_bytes : leaf_bytes) {
+        m_leaf_bytes += section_bytes;
+    }
+    m_tables = {
+        reinterpret_cast<const typename trie_type::node_type *>(m_image + header->section[header_type::NODES].offset),
+        m_leaves.get(),
+        reinterpret_cast<const typename trie_type::prefix_type *>(m_image + header->section[header_type::PREFIXES].offset),
+        reinterpret_cast<const value_type *>(m_image + header->section[header_type::VALUES].offset)
+    };
+}
+
+template <typename T>
+auto
+lctrie_view<T>::lookup(const key_type key) const -> value_type
+{
+    if (m_header->nodes == 0U) {
+        return trie_type::NO_VALUE;
+    }
+
+    return trie_type::find(m_tables, key);
+}
+
+/*
+ * Looks up @n keys into @out with the kernel the owning trie would use
+ */
+template <typename T>
+void
+lctrie_view<T>::lookup_batch(const key_type *keys, value_type *out, const size_t n) const
+{
+    if (m_header->nodes == 0U) {
+        std::fill_n(out, n, trie_type::NO_VALUE);
+        return;
+    }
+
+    trie_type::find_batch_widest(m_tables, m_leaf_bytes, keys, out, n);
+}
+
+/*
+ * A read-only copy of a built trie whose leaves keep only what a lookup
+ * cannot take from its own key. The walk to a slot fixes the key's leading
+ * bits down to the first skip; where every reachable slot agrees with its
+ * leaf on the first H of the bits it fixes, no leaf needs to store them,
+ * and the compare reads them as equal. Each leaf is then one bit-packed
+ * word of its KEY_BITS - H low key bits, its length, its value offset in
+ * ceil(log2(values)) bits and its pre in ceil(log2(prefixes + 1)) bits,
+ * stored plus one so that 0 is NO_PREFIX. A lookup reads it with a single
+ * unaligned load, so it touches no more lines than leaf_aos does.
+ *
+ * H depends on the shape of the nodes and the widths on the stored values,
+ * which is why this is a snapshot rather than a leaf layout of the trie:
+ * build one once the trie is final, and again after updating it.
+ */
+template <typename Trie>
+struct compressed_lctrie {
+    using trie_type = Trie;
+    using key_type = typename trie_type::key_type;
+    using value_type = typename trie_type::value_type;
+    using offset_type = typename trie_type::offset_type;
+    using node_type = typename trie_type::node_type;
+    using prefix_type = typename trie_type::prefix_type;
+    using memory_usage = typename trie_type::memory_usage;
+
+    static constexpr auto KEY_BITS = trie_type::KEY_BITS;
+
+    // enough for every length from 0 to KEY_BITS
+    static constexpr unsigned LEN_BITS = KEY_BITS < 64U ? 6U : KEY_BITS < 128U ? 7U : 8U;
+
+    // the widest leaf a 64-bit load at any bit offset reads whole
+    static constexpr unsigned MAX_WIDTH = 57U;
+
+    // the bytes a load past the last leaf may touch
+    static constexpr size_t PAD = 8U;
+
+    struct leaf_view {
+        uint64_t word(const size_t i) const
+        {
+            const auto bit = i * m_width;
+            return load_le64(m_bits + bit / 8U) >> (bit % 8U);
+        }
+
+        key_type diff(const size_t i, const key_type key) const
+        {
+            return key_type((key_type(word(i) & m_suffix_mask) ^ key) & m_suffix_mask);
+        }
+
+        uint8_t len(const size_t i) const
+        {
+            return uint8_t((word(i) >> m_suffix_bits) & ((uint64_t(1U) << LEN_BITS) - 1U));
+        }
+
+        offset_type offset(const size_t i) const
+        {
+            return offset_type((word(i) >> (m_suffix_bits + LEN_BITS)) & m_offset_mask);
+        }
+
+        // the stored 0 wraps around to NO_PREFIX
+        uint32_t pre(const size_t i) const
+        {
+            return uint32_t((word(i) >> m_pre_shift) & m_pre_mask) - 1U;
+        }
+
+        const void *address(const size_t i) const { return m_bits + i * m_width / 8U; }
+
+        const unsigned char *m_bits;
+        size_t m_width;
+        unsigned m_suffix_bits;
+        key_type m_suffix_mask;
+        uint64_t m_offset_mask;
+        unsigned m_pre_shift;
+        uint64_t m_pre_mask;
+    };
+
+    using table_type = typename trie_type::template table_view<leaf_view>;
+
+    explicit compressed_lctrie(const trie_type &trie);
+
+    compressed_lctrie(const compressed_lctrie &) = delete;
+    compressed_lctrie &operator=(const compressed_lctrie &) = delete;
+
+    value_type lookup(key_type key) const;
+    void lookup_batch(const key_type *keys, value_type *out, size_t n) const;
+    unsigned verified_bits() const;
+    size_t leaf_bits() const;
+    memory_usage memory() const;
+
+    static unsigned verified_bits(const trie_type &trie);
+    static uint64_t load_le64(const unsigned char *bytes);
+    static void store_le64(unsigned char *bytes, uint64_t word);
+
+    cache_vector<node_type> m_nodes;
+    cache_vector<unsigned char> m_bits;
+    cache_vector<prefix_type> m_prefixes;
+    cache_vector<value_type> m_vals;
+    size_t m_leaf_count = 0U;
+    unsigned m_verified = 0U;
+    leaf_view m_leaves = {};
+    table_type m_tables = {};
+};
+
+/*
+ * Packs the leaves of @trie; throws std::length_error when a leaf does not
+ * fit MAX_WIDTH bits, as with wide keys under shallow nodes
+ */
+template <typename T>
+compressed_lctrie<T>::compressed_lctrie(const trie_type &trie)
+{
+    if (!trie.m_nodes || trie.m_nodes->empty()) {
+        return;
+    }
+
+    const auto &data = *trie.m_data;
+    const auto bits_for = [](const size_t n) {
+        auto bits = 0U;
+
+        while ((uint64_t(1U) << bits) < n) {
+            ++bits;
+        }
+
+        return bits;
+    };
+
+    const auto offset_bits = bits_for(trie.m_vals->size());
+    const auto pre_bits = bits_for(trie.m_prefixes->size() + 1U);
+
+    m_verified = verified_bits(trie);
+
+    const auto suffix_bits = KEY_BITS - m_verified;
+    const auto pre_shift = suffix_bits + LEN_BITS + offset_bits;
+    const auto width = size_t(pre_shift + pre_bits);
+
+    if (width > MAX_WIDTH) {
+        throw std::length_error("lctrie: leaves too wide to compress");
+    }
+
+    const auto suffix_mask = suffix_bits == KEY_BITS ? key_type(~key_type(0U))
+                                                     : key_type((key_type(1U) << suffix_bits) - 1U);
+
+    m_leaf_count = data.size();
+    m_nodes.assign(trie.m_nodes->begin(), trie.m_nodes->end());
+    m_bits.assign((m_leaf_count * width + 7U) / 8U + PAD, 0U);
+    m_prefixes.assign(trie.m_prefixes->begin(), trie.m_prefixes->end());
+    m_vals.assign(trie.m_vals->begin(), trie.m_vals->end());
+
+    for (auto i = size_t(0U); i < m_leaf_count; ++i) {
+        const auto word = uint64_t(data.key(i) & suffix_mask) | (uint64_t(data.len(i)) << suffix_bits) |
+            (uint64_t(data.offset(i)) << (suffix_bits + LEN_BITS)) |
+            (uint64_t(uint32_t(data.pre(i) + 1U)) << pre_shift);
+        const auto bit = i * width;
+        auto *bytes = m_bits.data() + bit / 8U;
+
+        store_le64(bytes, load_le64(bytes) | (word << (bit % 8U)));
+    }
+
+    m_leaves = { m_bits.data(), width, suffix_bits, suffix_mask, (uint64_t(1U) << offset_bits) - 1U,
+                 pre_shift, (uint64_t(1U) << pre_bits) - 1U };
+    m_tables = { m_nodes.data(), &m_leaves, m_prefixes.data(), m_vals.data() };
+}
+
+/*
+ * Returns H, the least over the reachable slots of the leading key bits
+ * that the walk to the slot fixes before any skip and that the slot's leaf
+ * shares. A slot a fill factor below 1 left empty shares fewer of them
+ * with the leaf it was given than that leaf's own slot does.
+ */
+template <typename T>
+unsigned
+compressed_lctrie<T>::verified_bits(const trie_type &trie)
+{
+    // a node to visit, the key bits its walk fixed, the first @verified of
+    // them before any skip, and the @depth bits consumed above it
+    struct visit {
+        size_t pos;
+        key_type fixed;
+        size_t verified;
+        size_t depth;
+    };
+
+    const auto &nodes = *trie.m_nodes;
+    auto least = size_t(KEY_BITS);
+    std::vector<visit> stack = { { 0U, 0U, 0U, 0U } };
+
+    while (!stack.empty()) {
+        const auto at = stack.back();
+        const auto node = nodes[at.pos];
+
+        stack.pop_back();
+
+        if (node.branch == 0U) {
+            const auto shared = high_zero_count(key_type(at.fixed ^ trie.m_data->key(node.next)));
+            least = std::min(least, std::min(at.verified, size_t(shared)));
+            continue;
+        }
+
+        const auto first = at.depth + node.skip;
+        const auto depth = first + node.branch;
+        const auto verified = at.verified == first ? depth : at.verified;
+
+        for (auto i = size_t(0U); i < (size_t(1U) << node.branch); ++i) {
+            stack.push_back({ node.next + i, key_type(at.fixed | (key_type(i) << (KEY_BITS - depth))),
+                              verified, depth });
+        }
+    }
+
+    return unsigned(least);
+}
+
+template <typename T>
+inline uint64_t
+compressed_lctrie<T>::load_le64(const unsigned char *bytes)
+{
+    uint64_t word;
+
+    std::memcpy(&word, bytes, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+template <typename T>
+inline void
+compressed_lctrie<T>::store_le64(unsigned char *bytes, uint64_t word)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    std::memcpy(bytes, &word, sizeof(word));
+}
+
+template <typename T>
+inline auto
+compressed_lctrie<T>::lookup(const key_type key) const -> value_type
+{
+    if (m_nodes.empty()) {
+        return trie_type::NO_VALUE;
+    }
+
+    return trie_type::find(m_tables, key);
+}
+
+template <typename T>
+void
+compressed_lctrie<T>::lookup_batch(const key_type *keys, value_type *out, const size_t n) const
+{
+    if (m_nodes.empty()) {
+        std::fill_n(out, n, trie_type::NO_VALUE);
+        return;
+    }
+
+    trie_type::find_batch(m_tables, keys, out, n);
+}
+
+/*
+ * Returns H, the leading key bits no leaf stores
+ */
+template <typename T>
+unsigned
+compressed_lctrie<T>::verified_bits() const
+{
+    return m_verified;
+}
+
+/*
+ * Returns the bits each leaf takes in the packed array
+ */
+template <typename T>
+size_t
+compressed_lctrie<T>::leaf_bits() const
+{
+    return m_leaves.m_width;
+}
+
+template <typename T>
+auto
+compressed_lctrie<T>::memory() const -> memory_usage
+{
+    memory_usage usage = {};
+
+    usage.nodes = m_nodes.size() * sizeof(node_type);
+    usage.leaves = m_bits.size();
+    usage.prefixes = m_prefixes.size() * sizeof(prefix_type);
+    usage.values = m_vals.size() * sizeof(value_type);
+    usage.total = usage.nodes + usage.leaves + usage.prefixes + usage.values;
+
+    const auto routes = m_leaf_count + m_prefixes.size();
+
+    if (routes != 0U) {
+        usage.bytes_per_route = double(usage.total) / double(routes);
+    }
+
+    return usage;
+}
+
+/*
+ * Many tries, one per VRF, packed into one arena behind one compact array
+ * of roots. The tables share a single pool of interned values, and their
+ * nodes, leaves and prefixes are appended to shared arrays with the next
+ * and pre fields rebased, so a table costs its own entries and a copy of
+ * its root in m_roots, where the roots of busy tables share cache lines.
+ * A lookup reads the root of its table and walks the shared arrays with
+ * the trie's own find(). The next field must address the nodes and
+ * leaves of every table together.
+ */
+template <typename Trie>
+struct multi_lctrie {
+    using trie_type = Trie;
+    using key_type = typename trie_type::key_type;
+    using value_type = typename trie_type::value_type;
+    using route_input_type = typename trie_type::route_input_type;
+    using value_input_type = typename trie_type::value_input_type;
+    using build_options = typename trie_type::build_options;
+    using memory_usage = typename trie_type::memory_usage;
+    using node_type = typename trie_type::node_type;
+    using data_type = typename trie_type::data_type;
+    using data_array = typename trie_type::data_array;
+    using prefix_type = typename trie_type::prefix_type;
+    using node_storage = typename trie_type::node_storage;
+
+    void set_options(const build_options &options);
+    void init(const std::vector<route_input_type> &tables);
+
+    value_type lookup(size_t table, key_type key) const;
+    size_t table_count() const;
+    memory_usage memory() const;
+
+    build_options m_options;
+
+    // declared first so it outlives the arrays carved from it
+    std::unique_ptr<trie_arena> m_arena;
+    std::unique_ptr<cache_vector<node_type>> m_roots;
+    std::unique_ptr<cache_vector<node_type>> m_nodes;
+    std::unique_ptr<data_array> m_data;
+    std::unique_ptr<cache_vector<prefix_type>> m_prefixes;
+    std::unique_ptr<cache_vector<value_type>> m_vals;
+};
+
+/*
+ * Applies to the tables built by the next init(); arena is implied
+ */
+template <typename T>
+void
+multi_lctrie<T>::set_options(const build_options &options)
+{
+    m_options = options;
+}
+
+/*
+ * Builds table i from @tables[i], each sorted and unique as for
+ * trie_type::init(). The values of every table are interned once into the
+ * shared pool; each table is then built on its own with init_shared(),
+ * which takes its offsets from that pool without a copy of it, and
+ * appended to the shared arrays. An empty table's root is a leaf that
+ * matches every key with NO_VALUE.
+ */
+template <typename T>
+void
+multi_lctrie<T>::init(const std::vector<route_input_type> &tables)
+{
+    typename trie_type::value_map_type map;
+    value_input_type pool;
+    auto empty = false;
+
+    for (const auto &routes : tables) {
+        empty = empty || routes.empty();
+
+        for (const auto &route : routes) {
+            if (map.emplace(route.value, typename trie_type::offset_type(pool.size())).second) {
+                pool.push_back(route.value);
+            }
+        }
+    }
+
+    const auto none = std::find(pool.begin(), pool.end(), trie_type::NO_VALUE) - pool.begin();
+
+    if (empty && size_t(none) == pool.size()) {
+        pool.push_back(trie_type::NO_VALUE);
+    }
+
+    if (pool.size() > trie_type::MAX_OFFSET + 1U) {
+        throw std::length_error("lctrie: too many distinct values for offset_type");
+    }
+
+    auto options = m_options;
+
+    options.arena = false;
+    options.huge_pages = false;
+    options.numa_node = -1;
+
+    std::vector<std::unique_ptr<trie_type>> tries;
+    auto nodes = size_t(0U);
+    auto leaves = size_t(empty ? 1U : 0U);
+    auto prefixes = size_t(0U);
+
+    // with aligned children, every table starts on a cache line so the
+    // blocks it aligned stay aligned
+    const auto line = m_options.align_children ? trie_arena::ALIGN / sizeof(node_type) : 1U;
+
+    tries.reserve(tables.size());
+
+    for (const auto &routes : tables) {
+        auto trie = std::make_unique<trie_type>();
+
+        trie->set_options(options);
+        trie->init_shared(routes, map);
+        nodes = (nodes + line - 1U) / line * line + trie->m_nodes->size();
+        leaves += trie->m_data->size();
+        prefixes += trie->m_prefixes->size();
+        tries.push_back(std::move(trie));
+    }
+
+    if (nodes > trie_type::MAX_NEXT + 1U || leaves > trie_type::MAX_NEXT + 1U) {
+        throw std::length_error("lctrie: too many routes for the next field");
+    }
+
+    if (prefixes >= trie_type::NO_PREFIX) {
+        throw std::length_error("lctrie: too many prefixes for pre_type");
+    }
+
+    auto arena = std::make_unique<trie_arena>(
+        trie_arena::footprint<node_type>(tables.size()) + trie_arena::footprint<node_type>(nodes) +
+            data_array::footprint(leaves) + trie_arena::footprint<prefix_type>(prefixes) +
+            trie_arena::footprint<value_type>(pool.size()),
+        m_options.huge_pages, m_options.numa_node);
+
+    auto roots = std::make_unique<cache_vector<node_type>>(cache_allocator<node_type>(arena.get()));
+    auto node_copy = std::make_unique<cache_vector<node_type>>(cache_allocator<node_type>(arena.get()));
+    auto data_copy = std::make_unique<data_array>(arena.get());
+    auto prefix_copy = std::make_unique<cache_vector<prefix_type>>(cache_allocator<prefix_type>(arena.get()));
+    auto value_copy = std::make_unique<cache_vector<value_type>>(cache_allocator<value_type>(arena.get()));
+
+    roots->reserve(tables.size());
+    node_copy->reserve(nodes);
+    data_copy->reserve(leaves);
+    prefix_copy->reserve(prefixes);
+    value_copy->assign(pool.begin(), pool.end());
+
+    const auto rebase = [](const uint32_t pre, const size_t base) {
+        return pre == trie_type::NO_PREFIX ? pre : uint32_t(pre + base);
+    };
+
+    for (const auto &trie : tries) {
+        const auto node_base = (node_copy->size() + line - 1U) / line * line;
+        const auto leaf_base = data_copy->size();
+        const auto prefix_base = prefix_copy->size();
+
+        node_copy->resize(node_base);
+
+        for (auto node : *trie->m_nodes) {
+            node.next = node_storage(node.next + (node.branch != 0U ? node_base : leaf_base));
+            node_copy->push_back(node);
+        }
+
+        for (auto i = size_t(0U); i < trie->m_data->size(); ++i) {
+            data_copy->push_back({ trie->m_data->key(i), trie->m_data->len(i), trie->m_data->offset(i),
+                                   rebase(trie->m_data->pre(i), prefix_base) });
+        }
+
+        for (auto prefix : *trie->m_prefixes) {
+            prefix.pre = rebase(prefix.pre, prefix_base);
+            prefix_copy->push_back(prefix);
+        }
+
+        if (trie->m_nodes->empty()) {
+            roots->push_back({ 0U, 0U, node_storage(leaves - 1U) });
+        } else {
+            roots->push_back((*node_copy)[node_base]);
+        }
+    }
+
+    if (empty) {
+        data_copy->push_back({ key_type(0U), 0U, typename trie_type::offset_type(none), trie_type::NO_PREFIX });
+    }
+
+    m_roots = std::move(roots);
+    m_nodes = std::move(node_copy);
+    m_data = std::move(data_copy);
+    m_prefixes = std::move(prefix_copy);
+    m_vals = std::move(value_copy);
+    m_arena = std::move(arena);
+}
+
+/*
+ * Expects @table < table_count()
+ */
+template <typename T>
+inline auto
+multi_lctrie<T>::lookup(const size_t table, const key_type key) const -> value_type
+{
+    return trie_type::find(typename trie_type::template table_view<data_array>{
+                               m_nodes->data(), m_data.get(), m_prefixes->data(), m_vals->data() },
+                           (*m_roots)[table], key);
+}
+
+template <typename T>
+size_t
+multi_lctrie<T>::table_count() const
+{
+    return m_roots ? m_roots->size() : 0U;
+}
+
+/*
+ * As trie_type::memory(), over every table; the roots count as nodes
+ */
+template <typename T>
+auto
+multi_lctrie<T>::memory() const -> memory_usage
+{
+    memory_usage usage = {};
+
+    if (!m_roots) {
+        return usage;
+    }
+
+    usage.nodes = (m_roots->size() + m_nodes->size()) * sizeof(node_type);
+    usage.leaves = m_data->bytes();
+    usage.prefixes = m_prefixes->size() * sizeof(prefix_type);
+    usage.values = m_vals->size() * sizeof(value_type);
+    usage.total = usage.nodes + usage.leaves + usage.prefixes + usage.values;
+
+    const auto routes = m_data->size() + m_prefixes->size();
+
+    if (routes != 0U) {
+        usage.bytes_per_route = double(usage.total) / double(routes);
+    }
+
+    return usage;
+}
+
+/*
+ * A trie built at compile time from a fixed route list, for tables such as
+ * bogon lists and special-purpose ranges that never change. The routes are
+ * split into leaves and prefixes as add_routes() does, and the nodes come
+ * out exactly as make_node() builds them with a fill factor of 1: each node
+ * takes the longest skip its keys share and the widest branch whose
+ * children are all non-empty. Every array is sized for N routes and
+ * lookups share find() with the trie, so a static constexpr table sits in
+ * read-only data and costs nothing at startup:
+ *
+ *     static constexpr auto bogons = make_static_lctrie<lctrie>({
+ *         { 0x0a000000, 8, 1 }, { 0xac100000, 12, 1 }, { 0xc0a80000, 16, 1 }
+ *     });
+ *
+ * Routes must be sorted and unique as for init(); in a constant expression
+ * a list that is not fails to compile.
+ */
+template <typename Trie, size_t N>
+struct static_lctrie {
+    using trie_type = Trie;
+    using key_type = typename trie_type::key_type;
+    using value_type = typename trie_type::value_type;
+    using route_type = typename trie_type::route_type;
+    using mapped_route = typename trie_type::mapped_route;
+    using node_type = typename trie_type::node_type;
+    using node_storage = typename trie_type::node_storage;
+    using prefix_type = typename trie_type::prefix_type;
+    using pre_type = typename trie_type::pre_type;
+    using offset_type = typename trie_type::offset_type;
+
+    static constexpr auto KEY_BITS = trie_type::KEY_BITS;
+
+    // every node branches into non-empty children, so N leaves take fewer
+    // than 2N nodes
+    static constexpr size_t MAX_NODES = 2U * N;
+
+    static_assert(N >= 1U, "static_lctrie: needs at least one route");
+    static_assert(N - 1U <= trie_type::MAX_OFFSET, "static_lctrie: too many routes for offset_type");
+    static_assert(MAX_NODES - 1U <= trie_type::MAX_NEXT, "static_lctrie: too many routes for the next field");
+
+    // the leaves in the shape find_leaf() reads them
+    struct leaf_table {
+        std::array<typename trie_type::data_type, N> entries = {};
+
+        constexpr key_type key(const size_t i) const { return entries[i].key; }
+        constexpr key_type diff(const size_t i, const key_type k) const { return entries[i].key ^ k; }
+        constexpr uint8_t len(const size_t i) const { return entries[i].len; }
+        constexpr offset_type offset(const size_t i) const { return entries[i].offset; }
+        constexpr uint32_t pre(const size_t i) const { return entries[i].pre; }
+    };
+
+    constexpr explicit static_lctrie(const route_type (&routes)[N]);
+
+    constexpr value_type lookup(key_type key) const;
+
+    constexpr void make_node(size_t first, size_t nkeys, size_t pre, size_t pos);
+
+    std::array<node_type, MAX_NODES> m_nodes = {};
+    leaf_table m_leaves = {};
+    std::array<prefix_type, N> m_prefixes = {};
+    std::array<value_type, N> m_vals = {};
+    size_t m_node_count = 0U;
+    size_t m_leaf_count = 0U;
+    size_t m_prefix_count = 0U;
+};
+
+/*
+ * Each route keeps its own entry of m_vals, at the route's index
+ */
+template <typename T, size_t N>
+constexpr
+static_lctrie<T, N>::static_lctrie(const route_type (&routes)[N])
+{
+    const auto mapped = [&](const size_t i) {
+        const auto len = routes[i].len;
+        return mapped_route{ key_type(routes[i].prefix & trie_type::prefix_mask(len)), len, offset_type(i) };
+    };
+
+    for (auto i = size_t(0U); i < N; ++i) {
+        if (routes[i].len > KEY_BITS) {
+            throw std::invalid_argument("lctrie: prefix length exceeds the key width");
+        }
+
+        if (i != 0U && !trie_type::route_less(mapped(i - 1U), mapped(i))) {
+            throw std::invalid_argument("lctrie: routes must be sorted and unique; see ingest()");
+        }
+
+        m_vals[i] = routes[i].value;
+    }
+
+    // the prefixes covering the current route, longest last; a chain holds
+    // at most one prefix per length
+    std::array<size_t, KEY_BITS + 1U> open = {};
+    std::array<pre_type, KEY_BITS + 1U> open_pre = {};
+    auto depth = size_t(0U);
+
+    for (auto i = size_t(0U); i < N; ++i) {
+        const auto route = mapped(i);
+
+        while (depth != 0U && !trie_type::is_prefix(mapped(open[depth - 1U]), route)) {
+            --depth;
+        }
+
+        const auto pre = depth == 0U ? trie_type::NO_PREFIX : open_pre[depth - 1U];
+
+        if (i + 1U < N && trie_type::is_prefix(route, mapped(i + 1U))) {
+            open[depth] = i;
+            open_pre[depth] = pre_type(m_prefix_count);
+            ++depth;
+            m_prefixes[m_prefix_count++] = { route.len, route.offset, pre };
+        } else {
+            m_leaves.entries[m_leaf_count++] = { route.prefix, route.len, route.offset, pre };
+        }
+    }
+
+    m_node_count = 1U;
+    make_node(0U, m_leaf_count, 0U, 0U);
+}
+
+/*
+ * Builds the node at @pos for the @nkeys sorted keys starting at @first,
+ * all of which share their @pre leading bits, as make_node() does. The
+ * skip and the branch are found bit by bit, which only costs compile time.
+ */
+template <typename T, size_t N>
+constexpr void
+static_lctrie<T, N>::make_node(size_t first, const size_t nkeys, const size_t pre, const size_t pos)
+{
+    if (nkeys == 1U) {
+        m_nodes[pos] = { 0U, 0U, node_storage(first) };
+        return;
+    }
+
+    const auto last = first + nkeys;
+    const auto bit = [&](const size_t i, const size_t n) {
+        return (m_leaves.key(i) >> (KEY_BITS - 1U - n)) & 1U;
+    };
+
+    // leaf keys are distinct, so the first and last key differ somewhere
+    auto skip = size_t(0U);
+
+    while (bit(first, pre + skip) == bit(last - 1U, pre + skip)) {
+        ++skip;
+    }
+
+    const auto bitpos = uint8_t(KEY_BITS - 1U - (pre + skip));
+    const auto children = [&](const size_t branch) {
+        auto count = size_t(1U);
+
+        for (auto i = first + 1U; i < last; ++i) {
+            count += trie_type::extract(bitpos, uint8_t(branch), m_leaves.key(i)) !=
+                     trie_type::extract(bitpos, uint8_t(branch), m_leaves.key(i - 1U));
+        }
+
+        return count;
+    };
+
+    auto branch = size_t(1U);
+
+    while (branch < trie_type::MAX_BRANCH && pre + skip + branch < KEY_BITS &&
+           children(branch + 1U) == size_t(1U) << (branch + 1U)) {
+        ++branch;
+    }
+
+    const auto next = m_node_count;
+    const auto depth = pre + skip + branch;
+
+    m_node_count += size_t(1U) << branch;
+
+    for (auto pattern = 0U; pattern < (1U << branch); ++pattern) {
+        auto count = size_t(0U);
+
+        while (first + count < last &&
+               trie_type::extract(bitpos, uint8_t(branch), m_leaves.key(first + count)) == pattern) {
+            ++count;
+        }
+
+        make_node(first, count, depth, next + pattern);
+        first += count;
+    }
+
+    m_nodes[pos] = { node_storage(branch), node_storage(skip), node_storage(next) };
+}
+
+template <typename T, size_t N>
+constexpr auto
+static_lctrie<T, N>::lookup(const key_type key) const -> value_type
+{
+    return trie_type::find(typename trie_type::template table_view<leaf_table>{
+        m_nodes.data(), &m_leaves, m_prefixes.data(), m_vals.data() }, key);
+}
+
+/*
+ * Builds a static_lctrie, taking N from the length of the route list
+ */
+template <typename Trie, size_t N>
+constexpr static_lctrie<Trie, N>
+make_static_lctrie(const typename Trie::route_type (&routes)[N])
+{
+    return static_lctrie<Trie, N>(routes);
+}
+
+#if defined(LCTRIE_BENCHMARK)
+/*
+ * Benchmarks, built instead of the demo with
+ *
+ *     g++ -std=c++20 -O2 -DLCTRIE_BENCHMARK trie.cpp -o trie_bench -lbenchmark -pthread
+ *
+ * Synthetic tables of 1K to 2M routes follow the prefix length mix of a
+ * full IPv4 BGP table. LCTRIE_TABLE names a real table to run as well,
+ * listed as table size 0: one "prefix/len [next hop]" per line, which is
+ * what an MRT snapshot reduces to with
+ *
+ *     bgpdump -m rib.mrt | cut -d'|' -f6,9 | tr '|' ' '
+ *
+ * Keys are drawn uniformly or Zipf-skewed over the routes of the table, or
+ * replayed from LCTRIE_TRACE, one IPv4 address per line. Fill factors are
+ * in percent. The full matrix takes a while; pick from it with
+ * --benchmark_filter, e.g. 'bench_lookup<lctrie>/routes:1048576/'.
+ */
+
+enum bench_stream {
+    BENCH_UNIFORM,
+    BENCH_ZIPF,
+    BENCH_TRACE
+};
+
+// keys per lookup_batch() call, and keys in a stream
+static constexpr size_t BENCH_BATCH = 4096U;
+static constexpr size_t BENCH_KEYS = size_t(1U) << 20U;
+
+// dependent lookups per latency sample
+static constexpr size_t BENCH_CHAIN = 32U;
+
+// the weight of each prefix length, /8 to /24, in a full IPv4 table
+static constexpr unsigned BENCH_LENGTH_MIX[] = {
+    1, 1, 3, 8, 15, 30, 55, 100, 140, 80, 135, 260, 420, 450, 1050, 950, 6300
+};
+
+/*
+ * Returns @n distinct routes drawn from the length mix, under the unicast
+ * /8s, with next hops 1 to 256
+ */
+static lctrie::route_input_type
+bench_synthetic(const size_t n)
+{
+    std::mt19937 rng { uint32_t(n) };
+    std::discrete_distribution<unsigned> length(std::begin(BENCH_LENGTH_MIX), std::end(BENCH_LENGTH_MIX));
+    lctrie::route_input_type routes;
+    const lctrie trie;
 
-    const auto KEY_BYTES = 4U;
-    const auto KEY_BITS = 8U * KEY_BYTES;
+    routes.reserve(n);
 
-    void init();
-    void init_trie();
-    void init_map(const input_type &input);
-    void build(const input_type &input);
-    uint32_t extract(uint8_t pos, uint8_t branch, key_type k);
+    while (routes.size() < n) {
+        for (auto i = routes.size(); i < n; ++i) {
+            const auto len = uint8_t(8U + length(rng));
+            const auto prefix = uint32_t(((1U + rng() % 223U) << 24U) | (rng() & 0xFFFFFFU));
+            routes.push_back({ prefix, len, 1U + rng() % 256U });
+        }
 
-    std::unique_ptr<std::vector<node_type>> m_nodes;
-    std::unique_ptr<std::vector<data_type>> m_data;
-    std::unique_ptr<std::vector<value_type>> m_vals;
+        trie.ingest(routes);
+    }
 
-    using data_cit = std::vector<data_type>::const_iterator;
-};
+    return routes;
+}
 
 /*
- * expects (1 <= branch <= 31)
- * expects (pos >= branch - 1)
+ * Parses a dotted quad at @s, or returns false
  */
-uint32_t lctrie::extract(uint8_t pos, uint8_t branch, key_type key)
+static bool
+bench_parse_ipv4(const char *s, uint32_t &addr)
 {
-    key >>= (pos - (branch - 1));
-    return (key & ((1U << branch) - 1U));
+    unsigned a, b, c, d;
+
+    if (std::sscanf(s, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 || a > 255U || b > 255U || c > 255U || d > 255U) {
+        return false;
+    }
+
+    addr = (a << 24U) | (b << 16U) | (c << 8U) | d;
+    return true;
 }
 
-void
-lctrie::init_map(const input_type &input)
+/*
+ * Loads the table at @path, skipping IPv6 and malformed lines. A next hop
+ * given as an address is used as the value as it is.
+ */
+static lctrie::route_input_type
+bench_load_table(const char *path)
 {
-    if (input.size() > 0xFFU) {
-        std::cout << "unsupported number of lctrie values"
-        return;
+    std::ifstream in(path);
+
+    if (!in) {
+        throw std::runtime_error(std::string("lctrie: cannot open ") + path);
     }
 
-    m_keys = std::unique_ptr<std::vector<key_data_type>>(input.size());
-    m_vals = std::unique_ptr<std::vector<value_type>>();
+    lctrie::route_input_type routes;
+    const lctrie trie;
+    std::string line;
 
-    for (auto i = 0; i < input.size(); ++i) {
-        const auto key = input[i].first;
-        const auto val = input[i].second;
-        const auto itr = std::find(m_vals.cbegin(), m_vals.cend(), val);
+    while (std::getline(in, line)) {
+        char prefix[64];
+        char hop[64] = "1";
+        unsigned len;
+        uint32_t addr;
 
-        if (itr == m_vals.cend()) {
-            m_vals.push_back(val);
-            m_keys.push_back({ key, m_vals.size() - 1 });
-        } else {
-            m_keys.push_back({ key, std::distance(m_vals.cbegin(), itr) });
+        if (line.find(':') != std::string::npos ||
+            std::sscanf(line.c_str(), "%63[0-9.]/%u %63s", prefix, &len, hop) < 2 ||
+            len > 32U || !bench_parse_ipv4(prefix, addr)) {
+            continue;
         }
+
+        uint32_t next;
+        const uintptr_t value = bench_parse_ipv4(hop, next) ? next : std::strtoul(hop, nullptr, 0);
+
+        routes.push_back({ addr, uint8_t(len), value != 0U ? value : 1U });
     }
+
+    trie.ingest(routes);
+    return routes;
 }
 
+/*
+ * Returns the table of @n routes, or the LCTRIE_TABLE one for 0, as routes
+ * of Trie. Only the last table is kept.
+ */
+template <typename Trie>
+static const typename Trie::route_input_type &
+bench_routes(const size_t n)
+{
+    static std::mutex lock;
+    static size_t cached = ~size_t(0);
+    static typename Trie::route_input_type routes;
+
+    std::lock_guard<std::mutex> guard(lock);
 
-void
-lctrie::init_trie()
+    if (cached != n) {
+        const auto source = n != 0U ? bench_synthetic(n) : bench_load_table(std::getenv("LCTRIE_TABLE"));
+
+        routes.clear();
+        routes.reserve(source.size());
+
+        for (const auto &route : source) {
+            routes.push_back({ route.prefix, route.len, route.value });
+        }
+
+        cached = n;
+    }
+
+    return routes;
+}
+
+/*
+ * Returns the trie for the table of @n routes built with @fill percent and
+ * @root as root branch. Only the last trie is kept; the lookup benchmarks
+ * vary the stream fastest and the table slowest, so only a new fill, root
+ * or table builds another.
+ */
+template <typename Trie>
+static const Trie &
+bench_trie(const size_t n, const unsigned fill, const unsigned root)
 {
-    m_nodes = std::unique_ptr<std::vector<node_type>>();
-    make_node(0U, m_keys.size());
+    static std::mutex lock;
+    static std::tuple<size_t, unsigned, unsigned> cached;
+    static std::unique_ptr<Trie> trie;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (!trie || cached != std::make_tuple(n, fill, root)) {
+        typename Trie::build_options options;
+        options.fill_factor = double(fill) / 100.0;
+        options.root_branch = root;
+
+        trie.reset();
+        trie = std::make_unique<Trie>();
+        trie->set_options(options);
+
+        try {
+            trie->init(bench_routes<Trie>(n));
+        } catch (...) {
+            trie.reset();
+            throw;
+        }
+
+        cached = std::make_tuple(n, fill, root);
+    }
+
+    return *trie;
 }
 
-//
-// An optimized version could use lzcnt
-//
-auto high_zero_count(const size_t diff)
+/*
+ * Returns BENCH_KEYS keys of @stream over @routes; empty for a trace when
+ * LCTRIE_TRACE is not set. Zipf ranks the routes in a random order with an
+ * exponent of 1.
+ */
+template <typename Routes>
+static std::vector<uint32_t>
+bench_keys(const Routes &routes, const int stream)
 {
-    size_t count = 0U;
+    std::mt19937 rng(uint32_t(routes.size()) + uint32_t(stream));
+    std::vector<uint32_t> keys;
 
-    while((diff & 0x80000000U) == 0U) {
-        ++count;
-        diff <<= 1U;
+    const auto host = [&](const size_t i) {
+        const auto len = routes[i].len;
+        const auto mask = len == 0U ? ~0U : len == 32U ? 0U : ~0U >> len;
+        return routes[i].prefix | (rng() & mask);
+    };
+
+    if (stream == BENCH_TRACE) {
+        const auto path = std::getenv("LCTRIE_TRACE");
+        std::ifstream in(path != nullptr ? path : "");
+        std::string line;
+        uint32_t addr;
+
+        while (std::getline(in, line)) {
+            if (bench_parse_ipv4(line.c_str(), addr)) {
+                keys.push_back(addr);
+            }
+        }
+
+        return keys;
     }
 
-    return count;
+    keys.reserve(BENCH_KEYS);
+
+    if (stream == BENCH_UNIFORM) {
+        for (auto i = size_t(0U); i < BENCH_KEYS; ++i) {
+            keys.push_back(host(rng() % routes.size()));
+        }
+
+        return keys;
+    }
+
+    std::vector<size_t> rank(routes.size());
+    std::vector<double> cdf(routes.size());
+    auto sum = 0.0;
+
+    for (auto i = size_t(0U); i < routes.size(); ++i) {
+        rank[i] = i;
+        sum += 1.0 / double(i + 1U);
+        cdf[i] = sum;
+    }
+
+    std::shuffle(rank.begin(), rank.end(), rng);
+    std::uniform_real_distribution<double> dist(0.0, sum);
+
+    for (auto i = size_t(0U); i < BENCH_KEYS; ++i) {
+        const auto r = size_t(std::lower_bound(cdf.begin(), cdf.end(), dist(rng)) - cdf.begin());
+        keys.push_back(host(rank[std::min(r, routes.size() - 1U)]));
+    }
+
+    return keys;
 }
 
 /*
- * The skip is computed by XOR'ing the first and last elements of the range.
- * Since the range is sorted, if these two values have leading bits in common,
- * then every value in between will have those bits in common. The skip is
- * number of leading zeros before the first '1' of the XOR value, not counting
- * the @pre leading bits
+ * Returns the keys of @stream over the table of @n routes; only the last
+ * stream is kept
  */
-auto lctrie::compute_skip(
-    const size_t first,
-    const size_t nkeys,
-    const size_t pre)
+template <typename Trie>
+static const std::vector<uint32_t> &
+bench_stream_keys(const size_t n, const int stream)
 {
-    const auto last = first + nkeys - 1;
-    const auto diff = (m_keys[first] ^ m_keys[last]);
+    static std::mutex lock;
+    static std::pair<size_t, int> cached = { ~size_t(0), -1 };
+    static std::vector<uint32_t> keys;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (cached != std::make_pair(n, stream)) {
+        keys = bench_keys(bench_routes<Trie>(n), stream);
+        cached = { n, stream };
+    }
 
-    return high_zero_count(diff << pre);
+    return keys;
 }
 
 /*
- * branch is bounded below by 1 and above by the
- * min(# remaining bits, floor(log(# of keys)))
- *
- * We proceed by examining the two leftmost bits of
- * first and last. If first = 01xxxxxx, then we can't
- * have a branch of more than 1. This is because the list
- * is sorted, and therefore 00xxxxx cannot occur after
- * 01xxxxx, and thus the range covers at most 3 two-bit
- * values. The case where last = 10xxxxxx is similar
+ * args: workers, fill, root, routes. A table too large for the trie type
+ * is reported as an error.
  */
+template <typename Trie>
+static void
+bench_build(benchmark::State &state)
+{
+    const auto &routes = bench_routes<Trie>(size_t(state.range(3)));
 
-size_t
-lctrie::find_fork(
-    const size_t first,
-    const size_t last,
-    const size_t suffix_len)
+    typename Trie::build_options options;
+    options.fill_factor = double(state.range(1)) / 100.0;
+    options.root_branch = unsigned(state.range(2));
+    options.threads = unsigned(state.range(0));
+
+    typename Trie::memory_usage usage = {};
+
+    for (auto _ : state) {
+        auto trie = std::make_unique<Trie>();
+
+        trie->set_options(options);
+
+        try {
+            trie->init(routes);
+        } catch (const std::length_error &e) {
+            state.SkipWithError(e.what());
+            break;
+        }
+
+        benchmark::DoNotOptimize(trie->m_nodes->data());
+
+        state.PauseTiming();
+        usage = trie->memory();
+        trie.reset();
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(routes.size()));
+    state.counters["table"] = double(routes.size());
+    state.counters["bytes/route"] = usage.bytes_per_route;
+}
+
+/*
+ * args: stream, fill, root, routes. Every thread walks the stream from its
+ * own offset.
+ */
+template <typename Trie>
+static void
+bench_lookup(benchmark::State &state)
 {
-    auto prefix = m_keys[first] & ~((1U << suffix_len) - 1);
-    auto mask = (1U << (suffix_len - 1U));
-    auto fork = std::lower_bound(first, last, prefix | mask);
+    const auto n = size_t(state.range(3));
+    const Trie *trie;
+
+    try {
+        trie = &bench_trie<Trie>(n, unsigned(state.range(1)), unsigned(state.range(2)));
+    } catch (const std::length_error &e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    const auto &keys = bench_stream_keys<Trie>(n, int(state.range(0)));
+
+    if (keys.size() < BENCH_BATCH) {
+        state.SkipWithError("no keys; set LCTRIE_TRACE to replay a trace");
+        return;
+    }
 
+    std::vector<typename Trie::value_type> out(BENCH_BATCH);
+    const auto batches = keys.size() / BENCH_BATCH;
+    auto batch = size_t(state.thread_index()) * 7U;
 
+    for (auto _ : state) {
+        trie->lookup_batch(keys.data() + (batch % batches) * BENCH_BATCH, out.data(), BENCH_BATCH);
+        benchmark::DoNotOptimize(out.data());
+        ++batch;
+    }
 
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(BENCH_BATCH));
 }
 
-auto lctrie::compute_branch(
-    size_t first,
-    size_t last,
-    size_t prefix_len)
+#if defined(LCTRIE_COROUTINES)
+/*
+ * As bench_lookup(), with the keys pushed one at a time onto an
+ * interleaved_lookup of the default width
+ */
+template <typename Trie>
+static void
+bench_interleaved(benchmark::State &state)
+{
+    const auto n = size_t(state.range(3));
+    const Trie *trie;
+
+    try {
+        trie = &bench_trie<Trie>(n, unsigned(state.range(1)), unsigned(state.range(2)));
+    } catch (const std::length_error &e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    const auto &keys = bench_stream_keys<Trie>(n, int(state.range(0)));
+
+    if (keys.size() < BENCH_BATCH) {
+        state.SkipWithError("no keys; set LCTRIE_TRACE to replay a trace");
+        return;
+    }
+
+    std::vector<typename Trie::value_type> out(BENCH_BATCH);
+    interleaved_lookup<Trie> lookups;
+    const auto batches = keys.size() / BENCH_BATCH;
+    auto batch = size_t(state.thread_index()) * 7U;
+
+    for (auto _ : state) {
+        const auto *first = keys.data() + (batch % batches) * BENCH_BATCH;
+
+        for (size_t i = 0U; i < BENCH_BATCH; ++i) {
+            lookups.push(*trie, first[i], &out[i]);
+        }
+
+        lookups.drain();
+        benchmark::DoNotOptimize(out.data());
+        ++batch;
+    }
+
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(BENCH_BATCH));
+}
+#endif
+
+/*
+ * args: stream, fill, root, routes. Each lookup picks its key by the value
+ * of the one before, so lookups do not overlap. Reading the clock does not
+ * wait for them either, so chains of BENCH_CHAIN lookups are timed, and
+ * the percentiles are of the time per lookup in a chain, less the cost of
+ * reading the clock.
+ */
+template <typename Trie>
+static void
+bench_latency(benchmark::State &state)
 {
-    std::vector<size_t> ranges = { first, last };
-    auto suffix_len = KEY_BITS - prefix_len;
+    using clock = std::chrono::steady_clock;
+
+    const auto n = size_t(state.range(3));
+    const Trie *trie;
+
+    try {
+        trie = &bench_trie<Trie>(n, unsigned(state.range(1)), unsigned(state.range(2)));
+    } catch (const std::length_error &e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    const auto &keys = bench_stream_keys<Trie>(n, int(state.range(0)));
+
+    if (keys.empty()) {
+        state.SkipWithError("no keys; set LCTRIE_TRACE to replay a trace");
+        return;
+    }
+
+    std::vector<double> overhead(1000U);
 
-    for (auto i = 0U; i < ranges.size() - 1U; i += 2U) {
+    for (auto &sample : overhead) {
+        const auto start = clock::now();
+        sample = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    }
 
-    while (suffix_len > 1) {
-        auto fork = find_fork(first, last, suffix_len);
-        auto
+    std::nth_element(overhead.begin(), overhead.begin() + 500, overhead.end());
 
+    const auto clock_ns = overhead[500];
+    std::vector<double> samples;
+    auto i = size_t(0U);
+    auto value = typename Trie::value_type(0U);
 
+    samples.reserve(size_t(1U) << 20U);
 
+    for (auto _ : state) {
+        const auto start = clock::now();
 
+        for (auto j = size_t(0U); j < BENCH_CHAIN; ++j) {
+            i = (i + 1U + (value & 1U)) % keys.size();
+            value = trie->lookup(keys[i]);
+        }
 
-    branch++;
+        benchmark::DoNotOptimize(value);
+        const auto end = clock::now();
 
+        if (samples.size() < samples.capacity()) {
+            const auto ns = std::chrono::duration<double, std::nano>(end - start).count() - clock_ns;
+            samples.push_back(ns / double(BENCH_CHAIN));
+        }
+    }
 
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(BENCH_CHAIN));
 
+    std::sort(samples.begin(), samples.end());
 
+    for (const auto &p : { std::make_pair("p50_ns", 0.5), std::make_pair("p99_ns", 0.99),
+                           std::make_pair("p999_ns", 0.999) }) {
+        const auto at = std::min(samples.size() - 1U, size_t(p.second * double(samples.size())));
+        state.counters[p.first] = samples.empty() ? 0.0 : std::max(0.0, samples[at]);
+    }
 }
 
-void
-lctrie::make_node(size_t first, size_t nkeys, size_t pre)
+/*
+ * Table sizes to run, with 0 for LCTRIE_TABLE when it is set
+ */
+static std::vector<int64_t>
+bench_sizes()
 {
-    if (nkeys == 1U) {
-        m_nodes.push_back({ 0, 0, first });
+    std::vector<int64_t> sizes = { 1 << 10, 1 << 14, 1 << 17, 1 << 20, 2 << 20 };
+
+    if (std::getenv("LCTRIE_TABLE") != nullptr) {
+        sizes.push_back(0);
     }
 
-    const auto skip = compute_skip(first, nkeys, pre);
-    const auto branch = compute_branch(first, nkeys, pre, skip);
+    return sizes;
 }
 
-void
-lctrie::init(const input_type &input)
+static void
+bench_build_args(benchmark::internal::Benchmark *b)
 {
-    init_map(input);
-    init_trie();
+    // ArgsProduct() varies the first list fastest, so the table changes last
+    b->ArgNames({ "workers", "fill", "root", "routes" });
+    b->ArgsProduct({ { 1, 0 }, { 100, 50, 25 }, { 0, 16 }, bench_sizes() });
+    b->Unit(benchmark::kMillisecond);
+}
+
+static void
+bench_lookup_args(benchmark::internal::Benchmark *b)
+{
+    std::vector<int64_t> streams = { BENCH_UNIFORM, BENCH_ZIPF };
+
+    if (std::getenv("LCTRIE_TRACE") != nullptr) {
+        streams.push_back(BENCH_TRACE);
+    }
+
+    // ArgsProduct() varies the first list fastest, so the runs on one trie,
+    // every stream and thread count, follow each other
+    b->ArgNames({ "stream", "fill", "root", "routes" });
+    b->ArgsProduct({ streams, { 100, 50 }, { 0, 16 }, bench_sizes() });
+}
+
+static void
+bench_thread_args(benchmark::internal::Benchmark *b)
+{
+    bench_lookup_args(b);
+    b->ThreadRange(1, int(std::max(1U, std::thread::hardware_concurrency())));
+    b->UseRealTime();
+}
+
+// lctrie only addresses 1M nodes, so its larger tables report an error;
+// the full layouts cover every size
+using bench_packed = basic_lctrie<uint32_t, uintptr_t, uint32_t, node_layout<5, 7, 52>, leaf_packed>;
+using bench_soa = basic_lctrie<uint32_t, uintptr_t, uint32_t, node_layout<5, 7, 52>, leaf_soa>;
+
+BENCHMARK_TEMPLATE(bench_build, lctrie)->Apply(bench_build_args);
+BENCHMARK_TEMPLATE(bench_build, lctrie_full)->Apply(bench_build_args);
+BENCHMARK_TEMPLATE(bench_build, bench_packed)->Apply(bench_build_args);
+BENCHMARK_TEMPLATE(bench_build, bench_soa)->Apply(bench_build_args);
+
+BENCHMARK_TEMPLATE(bench_lookup, lctrie)->Apply(bench_thread_args);
+BENCHMARK_TEMPLATE(bench_lookup, lctrie_full)->Apply(bench_thread_args);
+BENCHMARK_TEMPLATE(bench_lookup, bench_packed)->Apply(bench_thread_args);
+BENCHMARK_TEMPLATE(bench_lookup, bench_soa)->Apply(bench_thread_args);
+
+#if defined(LCTRIE_COROUTINES)
+BENCHMARK_TEMPLATE(bench_interleaved, lctrie)->Apply(bench_thread_args);
+BENCHMARK_TEMPLATE(bench_interleaved, lctrie_full)->Apply(bench_thread_args);
+#endif
+
+BENCHMARK_TEMPLATE(bench_latency, lctrie)->Apply(bench_lookup_args);
+BENCHMARK_TEMPLATE(bench_latency, lctrie_full)->Apply(bench_lookup_args);
+BENCHMARK_TEMPLATE(bench_latency, bench_packed)->Apply(bench_lookup_args);
+BENCHMARK_TEMPLATE(bench_latency, bench_soa)->Apply(bench_lookup_args);
+
+BENCHMARK_MAIN();
+#elif defined(LCTRIE_STRESS)
+/*
+ * A stress run of concurrent_lctrie, built instead of the demo, e.g.
+ * under ThreadSanitizer with
+ *
+ *     g++ -std=c++20 -O1 -g -fsanitize=thread -DLCTRIE_STRESS trie.cpp -o trie_stress -pthread
+ *
+ * Three readers look up keys under the 256 /16s of 10/8, which never
+ * change, while the writer inserts and erases routes outside 10/8. Most
+ * updates go in place through try_insert(), try_erase() and, for every
+ * 64th, try_apply_batch(); the others rebuild and publish a copy. A
+ * lookup under 10/8 that does not return its /16's value fails the run.
+ */
+
+// updates the writer makes, and keys each reader looks up per burst
+static constexpr size_t STRESS_UPDATES = 4000U;
+static constexpr size_t STRESS_BURST = 64U;
+
+static uint32_t
+stress_random(uint64_t &state)
+{
+    state ^= state << 13U;
+    state ^= state >> 7U;
+    state ^= state << 17U;
+    return uint32_t(state >> 16U);
 }
 
+int main()
+{
+    lctrie::route_input_type routes;
+    uint64_t rng = 0x9e3779b97f4a7c15U;
+
+    for (auto i = 0U; i < 256U; ++i) {
+        routes.push_back({ 0x0a000000U | (i << 16U), 16, i + 1U });
+    }
+
+    // anything outside 10/8
+    const auto churn = [&rng]() {
+        const auto len = uint8_t(8U + stress_random(rng) % 25U);
+        auto prefix = stress_random(rng);
+
+        if ((prefix >> 24U) == 0x0aU) {
+            prefix ^= 0x01000000U;
+        }
+
+        return lctrie::route_type{ prefix & lctrie::prefix_mask(len), len, 1U + stress_random(rng) % 64U };
+    };
+
+    for (auto i = 0U; i < 20000U; ++i) {
+        routes.push_back(churn());
+    }
+
+    concurrent_lctrie<lctrie> shared(3U, 0.5);
+    shared.init(routes);
+
+    std::atomic<bool> done{ false };
+    std::atomic<uint64_t> lookups{ 0U };
+    std::atomic<uint64_t> wrong{ 0U };
+    std::vector<std::thread> readers;
+
+    for (auto t = 0U; t < 3U; ++t) {
+        readers.emplace_back([&, t]() {
+            const auto reader = shared.register_reader();
+            lookup_cache<lctrie> cache;
+            uint64_t state = 0x2545f4914f6cdd1dU * (t + 1U);
+            uint32_t keys[STRESS_BURST];
+            uintptr_t values[STRESS_BURST];
+            uint64_t count = 0U;
+
+            while (!done.load(std::memory_order_relaxed)) {
+                for (auto &key : keys) {
+                    key = 0x0a000000U | (stress_random(state) & 0xFFFFFFU);
+                }
+
+                // each reader takes another lookup path
+                if (t == 0U) {
+                    for (size_t i = 0U; i < STRESS_BURST; ++i) {
+                        values[i] = reader.lookup(keys[i]);
+                    }
+                } else if (t == 1U) {
+                    reader.lookup_batch(keys, values, STRESS_BURST);
+                } else {
+                    for (size_t i = 0U; i < STRESS_BURST; ++i) {
+                        values[i] = reader.lookup(keys[i], cache);
+                    }
+                }
+
+                reader.quiescent();
+
+                // leaves the writer a core when the readers have them all
+                std::this_thread::yield();
+
+                for (size_t i = 0U; i < STRESS_BURST; ++i) {
+                    if (values[i] != ((keys[i] >> 16U) & 0xFFU) + 1U) {
+                        wrong.fetch_add(1U, std::memory_order_relaxed);
+                    }
+                }
+
+                count += STRESS_BURST;
+            }
+
+            reader.offline();
+            lookups.fetch_add(count, std::memory_order_relaxed);
+        });
+    }
+
+    std::vector<lctrie::route_type> added;
+
+    for (size_t i = 0U; i < STRESS_UPDATES; ++i) {
+        if (i % 64U == 63U) {
+            lctrie::route_input_type adds = { churn(), churn() };
+            lctrie::prefix_input_type withdraws;
+
+            if (!added.empty()) {
+                withdraws.push_back({ added.back().prefix, added.back().len });
+                added.pop_back();
+            }
+
+            shared.apply_batch(adds, withdraws);
+        } else if (added.empty() || stress_random(rng) % 3U != 0U) {
+            const auto route = churn();
+
+            shared.insert(route.prefix, route.len, route.value);
+            added.push_back(route);
+        } else {
+            const auto at = stress_random(rng) % added.size();
+
+            shared.erase(added[at].prefix, added[at].len);
+            added[at] = added.back();
+            added.pop_back();
+        }
+    }
+
+    done.store(true, std::memory_order_relaxed);
+
+    for (auto &reader : readers) {
+        reader.join();
+    }
+
+    shared.synchronize();
+    std::cout << STRESS_UPDATES << " updates, " << lookups.load() << " lookups, " << wrong.load()
+              << " wrong\n";
+    return wrong.load() == 0U ? 0 : 1;
+}
+#else
 int main()
 {
     std::vector<std::pair<uint32_t, uintptr_t>> input = {
@@ -195,5 +7378,130 @@ int main()
     lctrie trie;
     trie.init(input);
 
+    for (const auto &in : input) {
+        std::cout << std::hex << in.first << " -> " << trie.lookup(in.first) << '\n';
+    }
+
+    lctrie::route_input_type routes = {
+        { 0x0a000000, 8, 0x1 },
+        { 0x0a010000, 16, 0x2 },
+        { 0x0a010100, 24, 0x3 },
+        { 0xc0a80000, 16, 0x4 }
+    };
+
+    trie.init(routes);
+
+    for (const auto key : { 0x0a000001U, 0x0a010001U, 0x0a010101U, 0xc0a80101U, 0x0b000000U }) {
+        std::cout << std::hex << key << " -> " << trie.lookup(key) << '\n';
+    }
+
+    trie.insert(0x0a010180, 25, 0x5);
+    trie.erase(0x0a010000, 16);
 
+    for (const auto key : { 0x0a010001U, 0x0a010101U, 0x0a010181U }) {
+        std::cout << std::hex << key << " -> " << trie.lookup(key) << '\n';
+    }
+
+    const auto stats = trie.stats();
+    std::cout << std::dec << stats.leaves << " leaves, " << stats.prefixes << " prefixes, depth "
+              << stats.average_depth << " average, " << stats.max_depth << " max\n";
+
+    lookup_cache<lctrie> cache;
+
+    for (const auto key : { 0x0a010181U, 0x0a010181U, 0x0a000001U, 0x0a010181U }) {
+        cache.lookup(trie, key);
+    }
+
+    trie.insert(0x0a010180, 25, 0x6);
+    std::cout << std::hex << 0x0a010181U << " -> " << cache.lookup(trie, 0x0a010181U) << std::dec
+              << ", cache hit rate " << cache.stats().hit_rate << '\n';
+
+    for (const auto &route : trie.routes()) {
+        std::cout << std::hex << route.prefix << '/' << std::dec << unsigned(route.len) << " -> "
+                  << std::hex << route.value << '\n';
+    }
+
+    const compressed_lctrie<lctrie> packed(trie);
+    std::cout << std::hex << 0x0a010181U << " -> " << packed.lookup(0x0a010181U) << std::dec << ", "
+              << packed.leaf_bits() << " bits per leaf\n";
+
+    // one table per VRF, sharing their values and one arena
+    multi_lctrie<lctrie> vrfs;
+    vrfs.init({ routes, { { 0x0a000000, 8, 0x7 } }, {} });
+
+    for (const auto key : { 0x0a010101U, 0x0a000001U }) {
+        std::cout << std::hex << key << " -> " << vrfs.lookup(0U, key) << ", " << vrfs.lookup(1U, key)
+                  << ", " << vrfs.lookup(2U, key) << '\n';
+    }
+
+    // one replica per NUMA node, each reader on its own node's copy
+    concurrent_lctrie<lctrie> shared(4U, 0.5, numa_nodes());
+    shared.init(routes);
+    shared.insert(0x0a010100, 24, 0x9);
+
+    const auto local = shared.register_reader();
+    std::cout << std::hex << 0x0a010101U << " -> " << local.lookup(0x0a010101U) << std::dec << ", "
+              << shared.m_numa_nodes.size() << " replicas\n";
+    local.offline();
+
+    // a BGP update message: withdraws and announcements published together
+    const auto batch = trie.apply_batch({ { 0x0a010200, 24, 0xa }, { 0x0a010180, 25, 0xb } },
+                                        { { 0x0a010100, 24 } });
+    std::cout << std::hex << 0x0a010101U << " -> " << trie.lookup(0x0a010101U) << ", " << 0x0a010201U
+              << " -> " << trie.lookup(0x0a010201U) << std::dec << ", " << batch.withdrawn
+              << " withdrawn, " << batch.updated << " updated, " << batch.subtries << " subtries\n";
+
+#if defined(LCTRIE_COROUTINES)
+    // a burst looked up a packet at a time, with other work in between
+    const uint32_t burst[] = { 0x0a010101U, 0x0a010201U, 0x0b000000U };
+    uintptr_t hops[std::size(burst)];
+    interleaved_lookup<lctrie> lookups;
+
+    for (size_t i = 0U; i < std::size(burst); ++i) {
+        lookups.push(trie, burst[i], &hops[i]);
+    }
+
+    lookups.drain();
+
+    for (size_t i = 0U; i < std::size(burst); ++i) {
+        std::cout << std::hex << burst[i] << " -> " << hops[i] << '\n';
+    }
+#endif
+
+    // routes as a dump parser hands them over, unsorted and never held whole
+    lctrie streamed;
+    lctrie_builder<lctrie> builder(streamed);
+
+    builder.push(routes.rbegin(), routes.rend());
+    builder.push(0x0a010100, 24, 0x8);
+    builder.finish();
+    std::cout << std::hex << 0x0a010101U << " -> " << streamed.lookup(0x0a010101U) << '\n';
+
+    // IPv6 /64 and shorter, keyed on the high half of the address
+    lctrie6_64::route_input_type routes6 = {
+        { 0x20010db800000000U, 32, 0x6 },
+        { 0x20010db8ab000000U, 40, 0x7 }
+    };
+
+    lctrie6_64 trie6;
+    trie6.init(routes6);
+
+    for (const auto key : { 0x20010db812340000U, 0x20010db8ab120000U, 0x20010db900000000U }) {
+        std::cout << std::hex << key << " -> " << trie6.lookup(key) << '\n';
+    }
+
+    // private and loopback ranges, built at compile time
+    static constexpr auto special = make_static_lctrie<lctrie>({
+        { 0x0a000000, 8, 0x1 },
+        { 0x7f000000, 8, 0x2 },
+        { 0xac100000, 12, 0x1 },
+        { 0xc0a80000, 16, 0x1 }
+    });
+
+    static_assert(special.lookup(0x7f000001U) == 0x2, "lookups on a static trie are constant");
+
+    for (const auto key : { 0xac100001U, 0xc0a80101U, 0x08080808U }) {
+        std::cout << std::hex << key << " -> " << special.lookup(key) << '\n';
+    }
 }
+#endif